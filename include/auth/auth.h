@@ -5,7 +5,9 @@
 #define MAX_USERNAME_LEN 20
 #define MAX_PASSWORD_LEN 20
 #define MAX_USERS 10
-#define AUTH_FILE "users.dat"
+#define AUTH_FILE "/users.dat"  // Absolute: saved from whatever directory the shell is in
+#define AUTH_FILE_MAX 1024
+#define AUTH_LINE_MAX (MAX_USERNAME_LEN + MAX_PASSWORD_LEN + 16)
 
 typedef struct {
     char username[MAX_USERNAME_LEN];
@@ -0,0 +1,14 @@
+// ata.h
+#ifndef ATA_H
+#define ATA_H
+
+#define ATA_SECTOR_SIZE 512
+#define ATA_MAX_TRANSFER 128    // Sectors per command, one 64 KB DMA window
+
+// Master drive on the primary ATA channel (QEMU's -hda), LBA28, offered
+// as block device "ata0". Single sectors go by PIO; longer transfers use
+// bus-master DMA when the IDE controller offers it. Requests complete
+// before submit returns, as completion is polled.
+int ata_init(void);             // -1 if there is no drive
+
+#endif
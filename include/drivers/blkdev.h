@@ -0,0 +1,49 @@
+// blkdev.h
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include "sched.h"
+
+#define BLKDEV_MAX 4
+#define BLK_SECTOR_SIZE 512
+#define BLK_PENDING 1           // Request status until the device is done
+
+// One transfer. Buffers must be physically contiguous.
+typedef struct blk_request {
+    unsigned int lba;
+    unsigned int count;         // Sectors
+    void *buf;
+    int write;
+    volatile int status;        // BLK_PENDING, then 0 or -1
+} blk_request;
+
+// A disk any filesystem can sit on. submit queues a batch of requests and
+// tells the device about them once; they complete in any order, possibly
+// before submit returns, each through blkdev_complete. Once it has taken
+// any request, submit must complete the rest too, with -1 if need be.
+typedef struct blkdev {
+    const char *name;
+    unsigned int sectors;
+    unsigned int max_batch;     // Requests worth queueing at once
+    int (*submit)(struct blkdev *dev, blk_request *reqs, int count);
+    void (*poll)(struct blkdev *dev);   // Reap completions with IRQs off
+    wait_queue done;
+} blkdev;
+
+int blkdev_register(blkdev *dev);       // -1 when the table is full
+int blkdev_count(void);
+blkdev *blkdev_get(int index);
+blkdev *blkdev_find(const char *name);
+
+// Asynchronous batches: submit, then wait for every request in it; wait
+// returns -1 if any failed
+int blkdev_submit(blkdev *dev, blk_request *reqs, int count);
+int blkdev_wait(blkdev *dev, blk_request *reqs, int count);
+void blkdev_complete(blkdev *dev, blk_request *req, int status);  // Drivers
+
+// Synchronous single transfers
+int blkdev_read(blkdev *dev, unsigned int lba, unsigned int count, void *buf);
+int blkdev_write(blkdev *dev, unsigned int lba, unsigned int count,
+                 const void *buf);
+
+#endif
@@ -0,0 +1,21 @@
+// keyboard.h
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+#define KEYBOARD_DATA_PORT 0x60
+#define KEYBOARD_BUFFER_SIZE 256  // Must be a power of two
+
+void keyboard_init(void);
+// Keys are queued per virtual console; both read the caller's console
+unsigned char keyboard_read_scancode(void);  // Sleeps until a key arrives
+int keyboard_poll_scancode(void);            // -1 if the buffer is empty
+
+// Scancode set 1 to ASCII, 0 for keys without a character
+extern const char keyboard_keymap[128];
+
+// Queue input from another device on a console as if typed there
+void keyboard_inject(int console, unsigned char scancode);
+void keyboard_inject_char(int console, char c);
+void keyboard_inject_arrow(int console, char code);  // 'A'..'D' of ESC [ x
+
+#endif
@@ -0,0 +1,54 @@
+// pci.h
+#ifndef PCI_H
+#define PCI_H
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+#define PCI_MAX_DEVICES 32
+
+// Configuration space offsets
+#define PCI_ID 0x00                 // Device << 16 | vendor
+#define PCI_COMMAND 0x04
+#define PCI_CLASS 0x08              // Class, subclass, prog-if, revision
+#define PCI_HEADER 0x0C              // Header type in bits 16-23
+#define PCI_BAR0 0x10
+#define PCI_BUS_NUMBERS 0x18         // Bridges: secondary bus in bits 8-15
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO 0x0001
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_BUS_MASTER 0x0004
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define PCI_CLASS_BRIDGE 0x06
+#define PCI_SUBCLASS_PCI_BRIDGE 0x04
+
+typedef struct {
+    unsigned char bus;
+    unsigned char dev;
+    unsigned char fn;
+    unsigned char irq;              // Legacy interrupt line, 0xFF if none
+    unsigned short vendor;
+    unsigned short device;
+    unsigned char class_code;
+    unsigned char subclass;
+    unsigned char prog_if;
+    unsigned int bar[6];            // Raw; see pci_bar_io and pci_bar_mem
+} pci_device;
+
+// Walk every bus reachable from bus 0 once, through PCI-to-PCI bridges;
+// drivers then look their functions up in the table
+void pci_init(void);
+int pci_device_count(void);
+pci_device *pci_get(int index);
+pci_device *pci_find(unsigned short vendor, unsigned short device);
+pci_device *pci_find_class(unsigned char class_code, unsigned char subclass);
+
+unsigned int pci_read32(const pci_device *d, unsigned int offset);
+void pci_write32(const pci_device *d, unsigned int offset, unsigned int value);
+unsigned int pci_bar_io(const pci_device *d, int bar);   // Port, 0 if not I/O
+unsigned int pci_bar_mem(const pci_device *d, int bar);  // Address, 0 if not memory
+void pci_enable(const pci_device *d, unsigned int command_bits);
+
+#endif
@@ -0,0 +1,17 @@
+// serial.h
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#define COM1_PORT 0x3F8
+#define SERIAL_BAUD 115200
+#define SERIAL_TX_SIZE 16384    // Must be a power of two
+#define SERIAL_CONSOLE 0        // Virtual console COM1 is attached to
+
+// 16550 UART on COM1. Output is queued in a ring and fed to the FIFO from
+// the transmit interrupt; received bytes are typed into SERIAL_CONSOLE.
+int serial_init(void);          // -1 if there is no UART
+int serial_present(void);
+void serial_write(const char *buf, unsigned int len);   // \n goes out as \r\n
+void serial_flush(void);        // Busy-waits until the ring is empty
+
+#endif
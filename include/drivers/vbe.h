@@ -0,0 +1,26 @@
+// vbe.h
+#ifndef VBE_H
+#define VBE_H
+
+// Bochs/QEMU VBE linear framebuffer used as a text console backend.
+// vga.c keeps the text model; this driver only turns cells into pixels.
+#define VBE_XRES 1024
+#define VBE_YRES 768
+#define VBE_BPP 32
+#define VBE_FONT_WIDTH 8
+#define VBE_FONT_HEIGHT 16
+#define VBE_COLS (VBE_XRES / VBE_FONT_WIDTH)    // 128
+#define VBE_ROWS (VBE_YRES / VBE_FONT_HEIGHT)   // 48
+
+int vbe_init(void);   // Must run while the adapter is still in text mode
+
+// Draw cells [x0, x1) of screen row y; cells use the VGA text layout
+void vbe_draw(int y, int x0, int x1, const unsigned short *cells);
+void vbe_draw_cursor(int x, int y, unsigned short cell);
+
+// Move the picture up by rows text lines with hardware panning; the rows
+// that come into view still need drawing. Returns -1 when the panning
+// range is used up: the caller must then redraw the whole screen.
+int vbe_scroll(int rows);
+
+#endif
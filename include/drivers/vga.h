@@ -2,16 +2,76 @@
 #ifndef VGA_H
 #define VGA_H
 
-#define VGA_WIDTH 80
-#define VGA_HEIGHT 25
+// Text grid size. It is 80x25 in text mode and grows when vga_init finds
+// a linear framebuffer (see vbe.h), so read it at run time.
+#define VGA_TEXT_WIDTH 80
+#define VGA_TEXT_HEIGHT 25
+#define VGA_MAX_WIDTH 128
+#define VGA_MAX_HEIGHT 48
+#define VGA_WIDTH vga_cols
+#define VGA_HEIGHT vga_rows
 #define VGA_BUFFER 0xB8000
+// Attribute byte: foreground colour in the low nibble, background high
+#define VGA_ATTR(fg, bg) (((bg) << 4) | (fg))
+#define VGA_BLACK 0
+#define VGA_BLUE 1
+#define VGA_GREEN 2
+#define VGA_CYAN 3
+#define VGA_RED 4
+#define VGA_MAGENTA 5
+#define VGA_BROWN 6
+#define VGA_LIGHT_GREY 7
+#define VGA_DARK_GREY 8
+#define VGA_LIGHT_BLUE 9
+#define VGA_LIGHT_GREEN 10
+#define VGA_LIGHT_CYAN 11
+#define VGA_LIGHT_RED 12
+#define VGA_LIGHT_MAGENTA 13
+#define VGA_YELLOW 14
+#define VGA_WHITE 15
+#define VGA_DEFAULT_ATTR VGA_ATTR(VGA_LIGHT_GREY, VGA_BLACK)
+
+#define VGA_CONSOLES 4   // Alt+F1..F4
+#define VGA_FLUSH_MS 20  // Longest a character waits before reaching MMIO
+
+// Scrollback: 1/VGA_SCROLLBACK_SHARE of free memory split across the
+// consoles, within these limits per console
+#define VGA_SCROLLBACK_SHARE 64
+#define VGA_SCROLLBACK_MIN 4096   // Lines
+#define VGA_SCROLLBACK_MAX 32768
 
 extern unsigned short *vga_buffer;
-extern int vga_x, vga_y;
+extern int vga_cols, vga_rows;
 
+// Output goes to the calling thread's virtual console (thread->console),
+// is drawn into that console's circular line store, and reaches the
+// screen on vga_flush() if the console is the one shown. The flush also
+// runs every VGA_FLUSH_MS once vga_init is called.
+void vga_init(void);  // Needs the heap; picks the backend, sizes the scrollback
+void vga_flush(void);
 void vga_clear(void);
 void vga_putc(char c);
 void vga_puts(const char *s);
+
+// Bulk output: printable runs are stored in one pass, and the hardware
+// cursor is only moved when the batch is flushed. Handles \n, \r, \b, \t.
+void vga_write(const char *buf, unsigned int len);
+void vga_write_attr(const char *buf, unsigned int len, unsigned char attr);
 void vga_putc_at(int x, int y, char c);
 
+// Scrollback browsing (Shift+PgUp/PgDn); output keeps going to the live
+// screen underneath
+void vga_scroll_view(int delta);  // Positive scrolls back into history
+void vga_scroll_live(void);
+
+// Console multiplexer: text written to a console is also handed to its
+// mirror (e.g. the serial port), outside the console lock. Positioned
+// writes (vga_putc_at) stay on screen only.
+typedef void (*vga_mirror)(const char *buf, unsigned int len);
+void vga_mirror_attach(int console, vga_mirror mirror);
+
+void vga_console_switch(int index);
+int vga_console_active(void);    // Console on screen, which gets keyboard input
+int vga_console_current(void);   // Console of the calling thread
+
 #endif
\ No newline at end of file
@@ -0,0 +1,10 @@
+// virtio_blk.h
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+// Legacy virtio-blk over PCI (QEMU's if=virtio), offered as block device
+// "vda". A batch of requests is placed on the ring and the device told
+// once; completions arrive by interrupt.
+int virtio_blk_init(void);      // -1 if there is no device
+
+#endif
@@ -0,0 +1,66 @@
+// bcache.h
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "blkdev.h"
+
+#define BCACHE_BLOCK_SIZE 4096
+#define BCACHE_SECTORS (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define BCACHE_RAM_FRACTION 16      // Up to 1/16 of RAM holds cached blocks
+#define BCACHE_MIN_BUFFERS 16
+#define BCACHE_BATCH 16             // Blocks per write-back submit
+#define BCACHE_RA_MIN 4             // First read-ahead of a sequential reader
+#define BCACHE_RA_MAX 32            // Largest read-ahead, in blocks
+#define BCACHE_STREAMS 4            // Sequential readers tracked at once
+#define BCACHE_FLUSH_MS 5000        // Longest a block stays dirty
+
+#define BUF_VALID 0x01
+#define BUF_DIRTY 0x02
+#define BUF_BUSY 0x04               // I/O in flight
+#define BUF_READAHEAD 0x08          // Read ahead and not yet asked for
+
+typedef struct bcache_buf {
+    blkdev *dev;                    // NULL while unused
+    unsigned int block;
+    unsigned int flags;
+    unsigned int refs;
+    unsigned char *data;            // BCACHE_BLOCK_SIZE bytes
+    struct bcache_buf *hash_next;
+    struct bcache_buf **hash_pprev;
+    struct bcache_buf *lru_prev;    // Towards the most recently used
+    struct bcache_buf *lru_next;
+} bcache_buf;
+
+typedef struct {
+    unsigned int buffers;           // Capacity
+    unsigned int used;              // Buffers given memory so far
+    unsigned int dirty;
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int readahead;         // Blocks read ahead
+    unsigned int readahead_hits;    // ... later asked for
+    unsigned int readahead_wasted;  // ... evicted first
+    unsigned int readahead_limit;   // Current cap on a reader's window
+    unsigned int writebacks;        // Dirty blocks written
+    unsigned int evictions;
+} bcache_stats;
+
+// Block cache, hashed by (device, block), with the least recently used
+// idle buffer recycled when full. Writes are delayed: a dirty buffer goes
+// to disk when it is evicted, on bcache_sync, or from the flusher thread
+// within BCACHE_FLUSH_MS. Readers found walking a device sequentially
+// get the next blocks in the same batch, in a window that doubles while
+// they keep coming and shrinks when read-ahead goes unused.
+void bcache_init(void);
+
+// Both return the buffer held; bcache_get skips the read, for callers
+// about to overwrite the whole block. NULL on a read error.
+bcache_buf *bcache_read(blkdev *dev, unsigned int block);
+bcache_buf *bcache_get(blkdev *dev, unsigned int block);
+void bcache_dirty(bcache_buf *b);
+void bcache_release(bcache_buf *b);
+
+int bcache_sync(void);              // -1 if a write failed
+void bcache_get_stats(bcache_stats *stats);
+
+#endif
@@ -0,0 +1,21 @@
+// dcache.h
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include "fs.h"
+
+#define DCACHE_ENTRIES 256
+#define DCACHE_BUCKETS 128      // Must be a power of two
+
+// Directory entry cache for the path walker: (directory, name) -> node,
+// including negative entries for names known not to exist. When full,
+// the least recently used entry is recycled.
+void dcache_init(void);
+int dcache_lookup(fs_node *dir, const char *name, unsigned int hash,
+                  fs_node **node);  // 1 on a hit; *node is NULL if negative
+void dcache_insert(fs_node *dir, const char *name, unsigned int hash,
+                   fs_node *node);
+void dcache_invalidate(fs_node *dir, const char *name, unsigned int hash);
+void dcache_purge_dir(fs_node *dir);  // Before dir's node is freed
+
+#endif
@@ -0,0 +1,85 @@
+// diskfs.h
+#ifndef DISKFS_H
+#define DISKFS_H
+
+#include "fs.h"
+#include "blkdev.h"
+#include "bcache.h"
+
+// On-disk layout, in DISKFS_BLOCK_SIZE blocks:
+//   0                superblock
+//   bitmap_start     block bitmap, one bit per block, set when in use
+//   inode_start      inode table, DISKFS_INODES_PER_BLOCK per block
+//   data_start       file data, directory blocks and indirect blocks
+// A block holds exactly one extent of a file, so extent i of a file is
+// its block i. Inode 0 is never used; the root directory is inode 1.
+#define DISKFS_MAGIC 0x53465348         // "HSFS"
+#define DISKFS_VERSION 1
+#define DISKFS_BLOCK_SIZE FS_EXTENT_SIZE
+#define DISKFS_SECTORS_PER_BLOCK (DISKFS_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define DISKFS_ROOT_INO 1
+#define DISKFS_DIRECT 12
+#define DISKFS_PER_INDIRECT (DISKFS_BLOCK_SIZE / 4)
+#define DISKFS_MAX_BLOCKS (DISKFS_DIRECT + DISKFS_PER_INDIRECT)
+#define DISKFS_INODE_SIZE 64
+#define DISKFS_INODES_PER_BLOCK (DISKFS_BLOCK_SIZE / DISKFS_INODE_SIZE)
+#define DISKFS_INODE_RATIO 4            // Data blocks per inode at format
+
+#define DISKFS_TYPE_FREE 0
+#define DISKFS_TYPE_FILE 1
+#define DISKFS_TYPE_DIR 2
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int block_count;
+    unsigned int inode_count;
+    unsigned int bitmap_start;
+    unsigned int bitmap_blocks;
+    unsigned int inode_start;
+    unsigned int inode_blocks;
+    unsigned int data_start;
+} diskfs_super;
+
+typedef struct {
+    unsigned short type;
+    unsigned short reserved;
+    unsigned int size;                  // Bytes; whole blocks for directories
+    unsigned int direct[DISKFS_DIRECT]; // 0 for a hole
+    unsigned int indirect;              // Block of DISKFS_PER_INDIRECT more
+    unsigned int unused;
+} diskfs_inode;
+
+// Directory blocks are arrays of these; ino 0 marks a free entry
+typedef struct {
+    unsigned int ino;
+    char name[MAX_FILENAME_LEN];
+} diskfs_dirent;
+
+#define DISKFS_DIRENTS_PER_BLOCK (DISKFS_BLOCK_SIZE / sizeof(diskfs_dirent))
+
+// Mount a block device. Only the superblock is read; a blank disk is
+// formatted first, one holding anything else is left alone.
+int diskfs_mount(blkdev *dev);                 // -1 if nothing was mounted
+int diskfs_mounted(void);
+blkdev *diskfs_device(void);                   // NULL if nothing is mounted
+
+// Called once per directory entry, with what its inode says
+typedef void (*diskfs_dirent_fn)(void *ctx, const char *name, unsigned int ino,
+                                 fs_node_type type, size_t size);
+int diskfs_read_dir(unsigned int dir_ino, diskfs_dirent_fn fn, void *ctx);
+
+// Metadata and data go to the buffer cache, which writes them back later;
+// all return -1 on I/O errors
+unsigned int diskfs_create(unsigned int dir_ino, const char *name,
+                           fs_node_type type);  // New inode, or 0
+int diskfs_unlink(unsigned int dir_ino, const char *name);
+int diskfs_free(unsigned int ino);      // Inode and every block it holds
+int diskfs_set_size(unsigned int ino, size_t size);  // Frees blocks past the end
+
+// Block index of file ino, held in the buffer cache for the caller to
+// read or change in place and then release. NULL for a hole, unless
+// alloc is set and a zeroed block is put there; NULL on errors too.
+bcache_buf *diskfs_block(unsigned int ino, unsigned int index, int alloc);
+
+#endif
@@ -0,0 +1,46 @@
+// file.h
+#ifndef FILE_H
+#define FILE_H
+
+#include "fs.h"
+#include "sched.h"
+
+// fs_open flags
+#define FS_O_READ   0x1
+#define FS_O_WRITE  0x2
+#define FS_O_CREATE 0x4  // Create the file if it doesn't exist
+#define FS_O_TRUNC  0x8  // Empty the file on open (with FS_O_WRITE)
+
+// fs_seek origins
+#define FS_SEEK_SET 0
+#define FS_SEEK_CUR 1
+#define FS_SEEK_END 2
+
+// An open file. Descriptors index the current thread's table of these
+// (thread.files); each holds its node open, so a file removed while
+// open stays readable until its last descriptor is closed.
+typedef struct fs_file {
+    fs_node *node;
+    size_t offset;
+    int flags;
+    struct bcache_buf *view;     // Cache block behind the last fs_read_view
+} fs_file;
+
+int fs_open(const char *path, int flags);  // Descriptor, or -1
+int fs_close(int fd);
+void fs_close_all(thread *t);              // Every descriptor of t
+
+// Copy up to len bytes from the current offset and advance past them;
+// 0 at the end of the file
+int fs_read(int fd, void *buf, size_t len);
+// Zero-copy read: the bytes from the current offset to the end of their
+// extent, advancing past them. NULL for a hole (read it as *len zeros)
+// and at the end of the file, where *len is 0. The bytes stay valid
+// until the next fs_read_view or fs_close of the descriptor.
+const char *fs_read_view(int fd, size_t *len);
+// Write at offset, growing the file as needed; the descriptor's own
+// offset is left alone
+int fs_write_at(int fd, size_t offset, const void *buf, size_t len);
+int fs_seek(int fd, int offset, int whence);  // New offset, or -1
+
+#endif
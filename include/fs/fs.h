@@ -5,9 +5,7 @@
 
 #define MAX_FILENAME_LEN 32
 #define MAX_PATH_LEN 128
-#define MAX_FILES 100
-#define MAX_DIRS 50
-#define MAX_FILE_SIZE 1024  // 1KB max file size
+#define FS_EXTENT_SIZE 4096  // File data is stored in page-sized extents
 
 // Define size_t if not available
 #ifndef _SIZE_T
@@ -20,29 +18,90 @@ typedef enum {
     TYPE_DIRECTORY
 } fs_node_type;
 
+#define FS_DIR_INITIAL_SLOTS 8  // Hash table size of a directory's first entry
+
+// Directory state, kept out of the node so files don't pay for it
+typedef struct fs_dir {
+    struct fs_node *children;
+    // Open-addressing table of children, keyed by name_hash
+    struct fs_node **entries;
+    unsigned int entry_slots;    // Power of two, 0 until the first child
+    unsigned int entry_count;
+    unsigned int entry_deleted;  // Tombstones
+    char *path;                  // Cached full path, see fs_node_path
+    int unloaded;                // Entries still only on disk
+} fs_dir;
+
+struct bcache_buf;
+
+#define FS_NODE_SIZE 64  // Nodes are slab-allocated on cache line boundaries
+
+// The hot part of every node: what lookups, walks and reads touch.
+// Names are interned and shared between nodes with the same name.
 typedef struct fs_node {
-    char name[MAX_FILENAME_LEN];
+    const char *name;
+    unsigned int name_hash;      // FNV-1a of name
     fs_node_type type;
-    char *data;
     size_t size;
-    size_t capacity;
+    char **extents;              // Extent i holds bytes [i, i+1) * FS_EXTENT_SIZE;
+                                 // files on disk have none, see fs_file_view
+    unsigned int extent_slots;   // Length of extents; NULL entries are holes
     struct fs_node *parent;
-    struct fs_node *children;
     struct fs_node *next; // for linked list of siblings
+    struct fs_node *prev;
+    unsigned int slot;           // Index in the parent's entry table
+    unsigned int open_count;     // Open descriptors, see file.h
+    unsigned int ino;            // Inode on disk, 0 for nodes only in RAM
+    fs_dir *dir;                 // Directories only, NULL for files
 } fs_node;
 
-// Filesystem functions
+// One lock covers the whole filesystem: the tree, the dentry cache, the
+// node slab and diskfs. Every fs_* entry point takes it, and it nests, so
+// they may call one another. It sleeps, since disk I/O happens under it.
+void fs_lock(void);
+void fs_unlock(void);
+
+// Filesystem functions. Paths may be absolute or relative to the current
+// directory, with any number of components, "." and "..".
 void fs_init(void);
 int fs_mkdir(const char *path);
-int fs_touch(const char *filename);  // Create empty file
+int fs_touch(const char *path);  // Create empty file
 int fs_write(const char *filename, const char *content);  // Write to file
+int fs_set_data(fs_node *file, const char *data, size_t size);  // Copies data
 int fs_cat(const char *filename);  // Read file content
 int fs_ls(const char *path);
 int fs_pwd(void);
 int fs_cd(const char *path);
 int fs_rm(const char *path);
 int fs_remove_node(fs_node *node);
+fs_node *fs_create(const char *path, fs_node_type type);  // Quiet; NULL on failure
 fs_node *fs_get_current_dir(void);
-fs_node *fs_find_file(const char *filename);  // Find file in current dir
+fs_node *fs_find_file(const char *path);
+fs_node *fs_lookup(const char *path);           // File or directory
+// Directory that would hold path's last component, which goes to leaf
+// (MAX_FILENAME_LEN bytes); NULL if that directory doesn't exist
+fs_node *fs_lookup_parent(const char *path, char *leaf);
+const char *fs_node_path(fs_node *dir);         // Full path, cached
+
+// Open references. A node removed while held is freed by the last release.
+void fs_node_hold(fs_node *node);
+void fs_node_release(fs_node *node);
+
+// File data. Writes allocate only the extents they touch and may leave
+// holes, which read back as zeros; reads stop at the end of the file.
+int fs_file_write(fs_node *file, size_t offset, const void *buf, size_t len);
+int fs_file_read(fs_node *file, size_t offset, void *buf, size_t len);
+int fs_file_truncate(fs_node *file, size_t size);
+// Zero-copy view of the bytes from offset to the end of their extent;
+// NULL for a hole (or at the end of the file), with *len still set. For
+// files on disk the view is a buffer cache block, returned in *held
+// (NULL otherwise) for the caller to bcache_release when done with it.
+const char *fs_file_view(fs_node *file, size_t offset, size_t *len,
+                         struct bcache_buf **held);
+
+// Directory entry tables
+unsigned int fs_name_hash(const char *name);
+fs_node *fs_dir_lookup(fs_node *dir, const char *name);
+int fs_dir_link(fs_node *dir, fs_node *node);  // -1 when out of memory
 
 #endif
\ No newline at end of file
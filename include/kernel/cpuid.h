@@ -0,0 +1,28 @@
+// cpuid.h
+#ifndef CPUID_H
+#define CPUID_H
+
+// Features the kernel cares about, filled in once by cpuid_init
+typedef struct {
+    char vendor[13];
+    unsigned int max_leaf;
+    int fpu;
+    int fxsr;       // fxsave/fxrstor
+    int sse;
+    int sse2;
+    int sse3;
+    int ssse3;
+    int sse41;
+    int sse42;
+    int xsave;
+    int avx;
+    int avx2;
+    int erms;       // Fast rep movsb/stosb
+} cpu_feature_set;
+
+extern cpu_feature_set cpu_features;
+
+void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]);
+void cpuid_init(void);
+
+#endif
@@ -0,0 +1,22 @@
+// fpu.h
+#ifndef FPU_H
+#define FPU_H
+
+struct thread;
+
+// FPU/SSE state is switched lazily: CR0.TS is set whenever a thread is
+// switched in, and the first FPU or SSE instruction it executes traps
+// with #NM, which loads its saved registers. Threads that never touch
+// those registers never pay for a save or restore. Interrupt handlers
+// must not use FPU or SSE instructions.
+
+void fpu_init(void);        // Boot CPU: pick the save format, install #NM
+void fpu_init_cpu(void);    // Every CPU: enable x87/SSE/AVX in CR0/CR4/XCR0
+
+int fpu_state_alloc(struct thread *t);  // Fresh default state, -1 on failure
+void fpu_state_free(struct thread *t);
+void fpu_switch_out(struct thread *prev);  // Save if used, re-arm the trap
+
+const char *fpu_save_format(void);  // "xsave", "fxsave", "fnsave" or "none"
+
+#endif
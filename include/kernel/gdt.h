@@ -0,0 +1,13 @@
+// gdt.h
+#ifndef GDT_H
+#define GDT_H
+
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_CPU_FIRST 3        // One %gs segment per CPU from this slot on
+
+void gdt_init(void);
+void gdt_set_cpu_base(int cpu, void *base);
+void gdt_load(int cpu);        // Load the table and this CPU's %gs
+
+#endif
@@ -0,0 +1,13 @@
+// heap.h
+#ifndef HEAP_H
+#define HEAP_H
+
+#define HEAP_MIN_CLASS 16     // Smallest slab object
+#define HEAP_MAX_CLASS 2048   // Larger requests are served from whole pages
+
+void heap_init(void);
+void *kmalloc(unsigned int size);
+void *kzalloc(unsigned int size);  // Zero-filled kmalloc
+void kfree(void *ptr);
+
+#endif
@@ -0,0 +1,38 @@
+// idt.h
+#ifndef IDT_H
+#define IDT_H
+
+#define IRQ_BASE 32         // PIC IRQs are remapped to vectors 32-47
+#define IRQ_TIMER 0
+#define IRQ_KEYBOARD 1
+#define IRQ_COM1 4
+
+// Register state pushed by the common stub in isr.asm
+typedef struct {
+    unsigned int gs, fs, es, ds;
+    unsigned int edi, esi, ebp, esp, ebx, edx, ecx, eax;
+    unsigned int int_no, err_code;
+    unsigned int eip, cs, eflags;
+} interrupt_frame;
+
+typedef void (*interrupt_handler)(interrupt_frame *frame);
+
+void idt_init(void);
+void idt_load(void);
+void isr_register(int vector, interrupt_handler handler);
+void irq_register(int irq, interrupt_handler handler);
+void irq_unmask(int irq);
+void irq_mask(int irq);
+
+// Disable interrupts, returning the previous EFLAGS for irq_restore()
+static inline unsigned int irq_save(void) {
+    unsigned int flags;
+    asm volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(unsigned int flags) {
+    asm volatile ("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+#endif
@@ -3,10 +3,15 @@
 #define KLIB_H
 
 #include "vga.h"
+#include "kmem.h"
 
 // Declare I/O functions
 unsigned char inb(unsigned short port);
 void outb(unsigned short port, unsigned char val);
+unsigned short inw(unsigned short port);
+void outw(unsigned short port, unsigned short val);
+unsigned int inl(unsigned short port);
+void outl(unsigned short port, unsigned int val);
 
 // Declare functions
 char kgetchar(void);
@@ -17,7 +22,6 @@ void kgets(char *buf, int max);
 
 // Utility functions
 int str_to_int(const char *str);
-void int_to_str(int num, char *str);
 void kstrcpy(char *dest, const char *src);
 void kstrcat(char *dest, const char *src);
 
@@ -0,0 +1,28 @@
+// kmem.h
+#ifndef KMEM_H
+#define KMEM_H
+
+// Memory primitives. Each has several implementations; kmem_init picks
+// the best one for this CPU once, after cpuid_init and fpu_init.
+void *kmemcpy(void *dest, const void *src, unsigned int n);
+void *kmemmove(void *dest, const void *src, unsigned int n);
+void *kmemset(void *dest, int c, unsigned int n);
+void *kmemsetw(void *dest, unsigned short value, unsigned int count);
+int kmemcmp(const void *a, const void *b, unsigned int n);
+
+void kmem_init(void);
+
+// One implementation family, exposed so membench can time each of them
+typedef struct {
+    const char *name;
+    int available;              // Usable on this CPU
+    void *(*copy)(void *dest, const void *src, unsigned int n);
+    void *(*set)(void *dest, int c, unsigned int n);
+    int (*compare)(const void *a, const void *b, unsigned int n);
+} kmem_variant;
+
+int kmem_variant_count(void);
+const kmem_variant *kmem_variant_get(int index);
+const char *kmem_selected(void);   // e.g. "copy erms, set erms, cmp sse2"
+
+#endif
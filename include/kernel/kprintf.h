@@ -0,0 +1,21 @@
+// kprintf.h
+#ifndef KPRINTF_H
+#define KPRINTF_H
+
+#include <stdarg.h>
+
+#define KPRINTF_BUFFER 256  // kprintf formats this much before each write
+
+// Conversions: %d %i %u %x %X %s %c %p %%, with the flags '-' and '0',
+// a field width (digits or *), and the length modifiers l and ll
+// (ll is 64-bit). The snprintf forms always NUL-terminate and return the
+// length the whole output would have had.
+int kvsnprintf(char *buf, unsigned int size, const char *fmt, va_list args);
+int ksnprintf(char *buf, unsigned int size, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Formats into a stack buffer that goes to the console in bulk writes
+int kvprintf(const char *fmt, va_list args);
+int kprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
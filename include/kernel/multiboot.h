@@ -0,0 +1,52 @@
+// multiboot.h
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+// multiboot_info.flags bits
+#define MULTIBOOT_INFO_MEMORY 0x001
+#define MULTIBOOT_INFO_MEM_MAP 0x040
+#define MULTIBOOT_INFO_FRAMEBUFFER 0x1000
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+typedef struct {
+    unsigned int flags;
+    unsigned int mem_lower;      // KB below 1 MB
+    unsigned int mem_upper;      // KB above 1 MB
+    unsigned int boot_device;
+    unsigned int cmdline;
+    unsigned int mods_count;
+    unsigned int mods_addr;
+    unsigned int syms[4];
+    unsigned int mmap_length;
+    unsigned int mmap_addr;
+    unsigned int drives_length;
+    unsigned int drives_addr;
+    unsigned int config_table;
+    unsigned int boot_loader_name;
+    unsigned int apm_table;
+    unsigned int vbe_control_info;
+    unsigned int vbe_mode_info;
+    unsigned short vbe_mode;
+    unsigned short vbe_interface_seg;
+    unsigned short vbe_interface_off;
+    unsigned short vbe_interface_len;
+    unsigned long long framebuffer_addr;
+    unsigned int framebuffer_pitch;
+    unsigned int framebuffer_width;
+    unsigned int framebuffer_height;
+    unsigned char framebuffer_bpp;
+    unsigned char framebuffer_type;
+} __attribute__((packed)) multiboot_info;
+
+// Memory map entries are variable length; "size" excludes itself
+typedef struct {
+    unsigned int size;
+    unsigned long long addr;
+    unsigned long long len;
+    unsigned int type;
+} __attribute__((packed)) multiboot_mmap_entry;
+
+#endif
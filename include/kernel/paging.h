@@ -0,0 +1,23 @@
+// paging.h
+#ifndef PAGING_H
+#define PAGING_H
+
+#define KERNEL_VIRT_BASE 0xC0000000  // Must match boot.asm and linker.ld
+#define LARGE_PAGE_SIZE 0x400000     // 4 MiB PSE page
+
+#define PAGE_PRESENT 0x001
+#define PAGE_WRITABLE 0x002
+#define PAGE_WRITE_THROUGH 0x008
+#define PAGE_CACHE_DISABLE 0x010
+#define PAGE_LARGE 0x080
+
+// Kernel image addresses <-> physical; all RAM is identity mapped
+#define V2P(addr) ((unsigned int)(addr) - KERNEL_VIRT_BASE)
+#define P2V(addr) ((unsigned int)(addr) + KERNEL_VIRT_BASE)
+
+void paging_init(void);
+int paging_map_mmio(unsigned int phys, unsigned int size);
+unsigned int virt_to_phys(const void *addr);
+unsigned int paging_directory_phys(void);  // CR3 value for other CPUs
+
+#endif
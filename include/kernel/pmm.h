@@ -0,0 +1,22 @@
+// pmm.h
+#ifndef PMM_H
+#define PMM_H
+
+#include "multiboot.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+
+void pmm_init(unsigned int magic, multiboot_info *mbi);
+
+// Physical frame allocation; addresses are page aligned, 0 means failure
+unsigned int pmm_alloc_frame(void);
+unsigned int pmm_alloc_frames(unsigned int count);  // Contiguous run
+void pmm_free_frame(unsigned int addr);
+void pmm_free_frames(unsigned int addr, unsigned int count);
+
+unsigned int pmm_total_frames(void);  // Usable frames reported at boot
+unsigned int pmm_free_count(void);
+unsigned int pmm_memory_top(void);    // End of the highest usable region
+
+#endif
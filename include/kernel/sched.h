@@ -0,0 +1,130 @@
+// sched.h
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "timer.h"
+#include "spinlock.h"
+
+#define MAX_CPUS 8
+#define THREAD_STACK_SIZE 16384
+#define THREAD_NAME_LEN 16
+#define THREAD_MAX_FILES 16      // Open file descriptors per thread
+#define SCHED_TIMESLICE_MS 10
+
+// Lower value = more urgent; the highest non-empty level always runs first
+#define PRIORITY_HIGH 0
+#define PRIORITY_NORMAL 1
+#define PRIORITY_LOW 2
+#define SCHED_PRIORITIES 3
+
+typedef enum {
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD
+} thread_state;
+
+typedef struct thread {
+    unsigned int esp;            // Saved stack pointer, used by switch.asm
+    unsigned int id;
+    char name[THREAD_NAME_LEN];
+    volatile thread_state state;
+    int priority;
+    int cpu;                     // CPU whose run queue the thread uses
+    int console;                 // Virtual console for output and input
+    volatile int on_cpu;         // Set until its context is fully saved
+    unsigned int slice_left;     // Ticks before preemption
+    unsigned long long cpu_ms;   // Ticks spent running
+    void (*entry)(void *arg);
+    void *arg;
+    void *stack;                 // NULL for the boot thread
+    void *fpu_state;             // Saved FPU/SSE registers (see fpu.c)
+    void *fpu_area;              // Allocation backing fpu_state
+    int fpu_cpu;                 // CPU that last loaded fpu_state, or -1
+    ktimer sleep_timer;
+    struct fs_file *files[THREAD_MAX_FILES];  // Descriptor table, see file.h
+    struct thread *next;         // Run queue or wait queue link
+    struct thread *all_next;     // Every live thread, for ps
+} thread;
+
+typedef struct {
+    thread *head;
+    thread *tail;
+} thread_queue;
+
+typedef struct {
+    spinlock lock;
+    thread_queue threads;
+} wait_queue;
+
+// Sleeping lock, for sections that may block or run long; contenders
+// sleep instead of spinning. Not for IRQ handlers.
+typedef struct {
+    wait_queue waiters;          // Its lock guards locked
+    volatile int locked;
+} mutex;
+
+#define MUTEX_INIT {{SPINLOCK_INIT, {0, 0}}, 0}
+
+// Per-CPU scheduler state, reached through %gs (see gdt.c)
+typedef struct cpu {
+    struct cpu *self;
+    int index;
+    unsigned int apic_id;
+    volatile int online;
+    spinlock lock;               // Protects run_queue and nr_ready
+    thread_queue run_queue[SCHED_PRIORITIES];
+    volatile unsigned int nr_ready;
+    thread *current;
+    thread *idle;
+    thread *switch_prev;         // Thread we are switching away from
+    thread *fpu_owner;           // Thread whose state is in the FPU
+    volatile int need_resched;
+    unsigned long long busy_ms;
+    unsigned long long idle_ms;
+    unsigned int window_ticks;   // Ticks in the current utilization window
+    unsigned int window_busy;
+    unsigned int utilization;    // Percent busy over the last second
+} cpu;
+
+extern cpu cpus[MAX_CPUS];
+extern int cpu_count;
+
+// Only meaningful with interrupts off: a thread preempted between reading
+// the pointer and using it may resume on another CPU
+static inline cpu *this_cpu(void) {
+    cpu *c;
+    asm volatile ("mov %%gs:0, %0" : "=r"(c));
+    return c;
+}
+
+void sched_init(void);
+void sched_init_ap(void *boot_stack);  // Adopt an AP's boot context as idle
+void sched_tick(void);                 // Called once per ms on every CPU
+void sched_use_local_timers(void);     // Stop the global PIT-driven tick
+thread *thread_create(const char *name, void (*entry)(void *arg), void *arg,
+                      int priority);
+void thread_exit(void);
+void thread_yield(void);
+void thread_sleep(unsigned int ms);
+thread *thread_current(void);
+
+// Walk every thread with the list locked; returns the saved IRQ flags
+thread *thread_list_lock(unsigned int *flags);
+void thread_list_unlock(unsigned int flags);
+
+// Wait queues. wait_queue_sleep must be called with wq->lock held via
+// spin_lock_irqsave; the lock is dropped while asleep and re-taken before
+// returning, so re-check the condition in a loop.
+void wait_queue_init(wait_queue *wq);
+void wait_queue_sleep(wait_queue *wq);
+void wait_queue_wake_one(wait_queue *wq);
+void wait_queue_wake_all(wait_queue *wq);
+
+void mutex_lock(mutex *m);
+void mutex_unlock(mutex *m);
+
+// Called by interrupt_dispatch on the way out of every IRQ
+void sched_irq_exit(void);
+
+#endif
@@ -0,0 +1,13 @@
+// smp.h
+#ifndef SMP_H
+#define SMP_H
+
+#define LAPIC_TIMER_VECTOR 0x40
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+#define AP_TRAMPOLINE_ADDR 0x8000    // Real-mode entry page for the APs
+
+void smp_init(void);
+int lapic_present(void);
+void lapic_eoi(void);
+
+#endif
@@ -0,0 +1,38 @@
+// spinlock.h
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "idt.h"
+
+typedef struct {
+    volatile unsigned int locked;
+} spinlock;
+
+#define SPINLOCK_INIT {0}
+
+static inline void spin_lock(spinlock *lock) {
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        // Spin on a plain read so waiters don't bounce the cache line
+        while (lock->locked) {
+            asm volatile ("pause");
+        }
+    }
+}
+
+static inline void spin_unlock(spinlock *lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+// Locks also taken from IRQ handlers must be held with interrupts off
+static inline unsigned int spin_lock_irqsave(spinlock *lock) {
+    unsigned int flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock *lock, unsigned int flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif
@@ -0,0 +1,21 @@
+// strbuf.h
+#ifndef STRBUF_H
+#define STRBUF_H
+
+// Length-tracking string builder over a caller's fixed buffer. Appends
+// cost only the bytes added, the buffer stays NUL-terminated, and text
+// that doesn't fit is dropped with truncated set instead of overflowing.
+typedef struct {
+    char *buf;
+    unsigned int size;     // Including the terminating NUL
+    unsigned int len;
+    int truncated;
+} strbuf;
+
+void sb_init(strbuf *sb, char *buf, unsigned int size);
+void sb_append(strbuf *sb, const char *s);
+void sb_append_n(strbuf *sb, const char *s, unsigned int n);
+void sb_append_char(strbuf *sb, char c);
+void sb_append_int(strbuf *sb, int value);
+
+#endif
@@ -0,0 +1,30 @@
+// timer.h
+#ifndef TIMER_H
+#define TIMER_H
+
+#define TIMER_HZ 1000           // PIT tick rate; one tick per millisecond
+#define TIMER_WHEEL_SLOTS 256   // Must be a power of two
+
+typedef void (*timer_callback)(void *arg);
+
+// A one-shot or periodic timer, zeroed before first use. Callbacks run in
+// IRQ0 context, so they must be short and must not block.
+typedef struct ktimer {
+    unsigned long long expires;  // Absolute tick of the next expiry
+    unsigned int period;         // Re-arm interval in ms, 0 for one-shot
+    timer_callback callback;
+    void *arg;
+    struct ktimer *next;
+    struct ktimer **pprev;       // Slot link pointing at us, NULL if idle
+    struct ktimer *fire_next;    // Expired list built during a tick
+} ktimer;
+
+void timer_init(void);
+unsigned long long ktime_ms(void);  // Milliseconds since timer_init()
+void ksleep(unsigned int ms);
+
+void timer_start(ktimer *timer, unsigned int delay_ms, unsigned int period_ms,
+                 timer_callback callback, void *arg);
+void timer_cancel(ktimer *timer);
+
+#endif
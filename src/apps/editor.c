@@ -1,7 +1,9 @@
 // editor.c
 #include "vga.h"
 #include "klib.h"
-#include "fs.h"
+#include "file.h"
+#include "keyboard.h"
+#include "kprintf.h"
 
 #define EDITOR_BUFFER_SIZE 1024
 
@@ -18,27 +20,22 @@ void editor_nano(const char *filename) {
     int ctrl_pressed = 0;
     
     vga_clear();
-    vga_puts("ShOS Text Editor - Editing: ");
-    vga_puts(filename);
-    vga_puts("\n");
+    kprintf("ShOS Text Editor - Editing: %s\n", filename);
     vga_puts("Press Ctrl+S to save, Ctrl+X to exit without saving\n");
     vga_puts("---------------------------------------------------\n");
     
     // Load existing file content if it exists
-    fs_node *file = fs_find_file(filename);
-    if (file != NULL && file->data != NULL) {
-        kstrcpy(buffer, file->data);
-        cursor = kstrlen(buffer);
-        vga_puts(buffer);
+    int fd = fs_open(filename, FS_O_READ);
+    if (fd >= 0) {
+        // Files written elsewhere can be bigger than the edit buffer
+        cursor = fs_read(fd, buffer, EDITOR_BUFFER_SIZE - 1);
+        fs_close(fd);
+        buffer[cursor] = '\0';
+        vga_write(buffer, cursor);
     }
     
     while (editing) {
-        // Check if key is available
-        if ((inb(0x64) & 1) == 0) {
-            continue; // No key available
-        }
-        
-        unsigned char scancode = inb(0x60);
+        unsigned char scancode = keyboard_read_scancode();
         
         // Handle key press (scancode < 0x80)
         if (scancode < 0x80) {
@@ -132,8 +129,7 @@ void editor_nano(const char *filename) {
     vga_puts("\nPress any key to return to shell...\n");
     
     // Wait for any key
-    while ((inb(0x64) & 1) == 0); // Wait for key
-    inb(0x60); // Read and discard the key
+    keyboard_read_scancode(); // Read and discard the key
     
     vga_clear();
 }
\ No newline at end of file
@@ -8,10 +8,24 @@
 #include "apps/shell.h"
 #include "fs/fs.h"
 #include "editor.h"
+#include "pmm.h"
+#include "heap.h"
+#include "sched.h"
+#include "idt.h"
+#include "cpuid.h"
+#include "fpu.h"
+#include "timer.h"
+#include "serial.h"
+#include "kprintf.h"
+#include "strbuf.h"
+#include "blkdev.h"
+#include "bcache.h"
+#include "diskfs.h"
 #include <stddef.h>
 
 #define MAX_INPUT 80
 #define MAX_ARGS 10
+#define HELP_COMMAND_ATTR VGA_ATTR(VGA_LIGHT_CYAN, VGA_BLACK)
 
 // Function prototypes for commands
 void cmd_help(char *args[]);
@@ -33,6 +47,12 @@ void cmd_cat(char *args[]);
 void cmd_edit(char *args[]);
 void cmd_write(char *args[]);
 void cmd_rm(char *args[]);
+void cmd_ps(char *args[]);
+void cmd_cpus(char *args[]);
+void cmd_membench(char *args[]);
+void cmd_blkbench(char *args[]);
+void cmd_sync(char *args[]);
+void cmd_cachestat(char *args[]);
 
 // Command structure
 typedef struct {
@@ -53,7 +73,7 @@ Command commands[] = {
     {"mul", cmd_multiply, "Multiply two numbers: mul <num1> <num2>"},
     {"div", cmd_divide, "Divide two numbers: div <num1> <num2>"},
     {"tictactoe", cmd_tictactoe, "Play Tic Tac Toe game"},
-    {"mkdir", cmd_mkdir, "Create directory: mkdir <dirname>"},
+    {"mkdir", cmd_mkdir, "Create directory: mkdir <path>"},
     {"ls", cmd_ls, "List directory contents: ls [path]"},
     {"pwd", cmd_pwd, "Print working directory"},
     {"cd", cmd_cd, "Change directory: cd [path]"},
@@ -62,6 +82,12 @@ Command commands[] = {
     {"edit", cmd_edit, "Edit file: edit <filename>"},
     {"write", cmd_write, "Write to file: write <filename> <content>"},
     {"rm", cmd_rm, "Remove file or empty directory: rm <path>"},
+    {"ps", cmd_ps, "List threads and their CPU time"},
+    {"cpus", cmd_cpus, "Show per-CPU load and run queues"},
+    {"membench", cmd_membench, "Time each memcpy/memset/memcmp variant"},
+    {"blkbench", cmd_blkbench, "Time disk reads and writes: blkbench [device]"},
+    {"sync", cmd_sync, "Write cached disk blocks back now"},
+    {"cachestat", cmd_cachestat, "Show buffer cache hits, read-ahead and write-back"},
     {0, 0, 0} // End marker
 };
 
@@ -92,11 +118,12 @@ void cmd_help(char *args[]) {
     (void)args; // Unused parameter
     vga_puts("Available commands:\n");
     for (int i = 0; commands[i].name; i++) {
-        vga_puts("  ");
-        vga_puts(commands[i].name);
-        vga_puts(" - ");
-        vga_puts(commands[i].description);
-        vga_puts("\n");
+        vga_write("  ", 2);
+        vga_write_attr(commands[i].name, kstrlen(commands[i].name),
+                       HELP_COMMAND_ATTR);
+        vga_write(" - ", 3);
+        vga_write(commands[i].description, kstrlen(commands[i].description));
+        vga_write("\n", 1);
     }
 }
 
@@ -117,14 +144,38 @@ void cmd_info(char *args[]) {
     (void)args; // Unused parameter
     vga_puts("ShOS v1.0\n");  // Changed from MyOS to ShOS
     vga_puts("Simple operating system kernel\n");
-    vga_puts("VGA text mode: 80x25\n");
+    kprintf("Console: %dx%d %s\n", VGA_WIDTH, VGA_HEIGHT,
+            VGA_WIDTH > VGA_TEXT_WIDTH ? "framebuffer" : "text mode");
+    kprintf("Memory: %u MB usable, %u MB free\n",
+            pmm_total_frames() / (1024 * 1024 / PAGE_SIZE),
+            pmm_free_count() / (1024 * 1024 / PAGE_SIZE));
+
+    kprintf("CPU: %s", cpu_features.vendor);
+    static const struct { const char *name; int *present; } flags[] = {
+        {"fpu", &cpu_features.fpu}, {"sse", &cpu_features.sse},
+        {"sse2", &cpu_features.sse2}, {"sse3", &cpu_features.sse3},
+        {"ssse3", &cpu_features.ssse3}, {"sse4.1", &cpu_features.sse41},
+        {"sse4.2", &cpu_features.sse42}, {"avx", &cpu_features.avx},
+        {"avx2", &cpu_features.avx2}, {"erms", &cpu_features.erms},
+    };
+    for (unsigned int i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        if (*flags[i].present) {
+            kprintf(" %s", flags[i].name);
+        }
+    }
+    kprintf("\nFPU state: %s, switched lazily\n", fpu_save_format());
 }
 
 void cmd_shutdown(char *args[]) {
     (void)args; // Unused parameter
     vga_puts("System shutting down...\n");
+    if (bcache_sync() != 0) {
+        vga_puts("Some cached disk blocks could not be written\n");
+    }
     // In a real OS, we would actually shut down the system
     // For now, just halt
+    vga_flush();
+    serial_flush();
     asm volatile ("cli");
     asm volatile ("hlt");
 }
@@ -137,14 +188,7 @@ void cmd_add(char *args[]) {
     
     int num1 = str_to_int(args[1]);
     int num2 = str_to_int(args[2]);
-    int result = num1 + num2;
-    
-    char result_str[20];
-    int_to_str(result, result_str);
-    
-    vga_puts("Result: ");
-    vga_puts(result_str);
-    vga_puts("\n");
+    kprintf("Result: %d\n", num1 + num2);
 }
 
 void cmd_subtract(char *args[]) {
@@ -155,14 +199,7 @@ void cmd_subtract(char *args[]) {
     
     int num1 = str_to_int(args[1]);
     int num2 = str_to_int(args[2]);
-    int result = num1 - num2;
-    
-    char result_str[20];
-    int_to_str(result, result_str);
-    
-    vga_puts("Result: ");
-    vga_puts(result_str);
-    vga_puts("\n");
+    kprintf("Result: %d\n", num1 - num2);
 }
 
 void cmd_multiply(char *args[]) {
@@ -173,14 +210,7 @@ void cmd_multiply(char *args[]) {
     
     int num1 = str_to_int(args[1]);
     int num2 = str_to_int(args[2]);
-    int result = num1 * num2;
-    
-    char result_str[20];
-    int_to_str(result, result_str);
-    
-    vga_puts("Result: ");
-    vga_puts(result_str);
-    vga_puts("\n");
+    kprintf("Result: %d\n", num1 * num2);
 }
 
 void cmd_divide(char *args[]) {
@@ -197,14 +227,7 @@ void cmd_divide(char *args[]) {
         return;
     }
     
-    int result = num1 / num2;
-    
-    char result_str[20];
-    int_to_str(result, result_str);
-    
-    vga_puts("Result: ");
-    vga_puts(result_str);
-    vga_puts("\n");
+    kprintf("Result: %d\n", num1 / num2);
 }
 
 void cmd_tictactoe(char *args[]) {
@@ -275,13 +298,18 @@ void cmd_write(char *args[]) {
     }
     
     // Combine all arguments after filename as content
-    char content[256] = {0};
+    char content[256];
+    strbuf sb;
+    sb_init(&sb, content, sizeof(content));
     for (int i = 2; args[i]; i++) {
-        kstrcat(content, args[i]);
+        sb_append(&sb, args[i]);
         if (args[i + 1]) {
-            kstrcat(content, " ");
+            sb_append_char(&sb, ' ');
         }
     }
+    if (sb.truncated) {
+        kprintf("Content too long, truncated to %u characters\n", sb.len);
+    }
     
     fs_write(args[1], content);
 }
@@ -294,6 +322,297 @@ void cmd_rm(char *args[]) {
     fs_rm(args[1]);
 }
 
+void cmd_ps(char *args[]) {
+    (void)args;
+    static const char *state_names[] = {"ready", "running", "blocked", "dead"};
+    
+    kprintf("%-5s%-9s%-5s%-5s%-10sNAME\n", "ID", "STATE", "PRI", "CON", "CPU(ms)");
+    
+    // Threads can exit while we walk the list, so keep it locked
+    unsigned int flags;
+    for (thread *t = thread_list_lock(&flags); t != NULL; t = t->all_next) {
+        kprintf("%-5d%-9s%-5d%-5d%-10llu%s\n", t->id, state_names[t->state],
+                t->priority, t->console + 1, t->cpu_ms, t->name);
+    }
+    thread_list_unlock(flags);
+}
+
+void cmd_cpus(char *args[]) {
+    (void)args;
+
+    kprintf("%-5s%-6s%-7s%-6s%-10s%-10sRUNNING\n",
+            "CPU", "APIC", "READY", "LOAD", "BUSY(ms)", "IDLE(ms)");
+
+    // Holding the thread list keeps each CPU's current thread alive
+    unsigned int flags;
+    thread_list_lock(&flags);
+    for (int i = 0; i < cpu_count; i++) {
+        cpu *c = &cpus[i];
+        char load[8];
+        ksnprintf(load, sizeof(load), "%u%%", c->utilization);
+        kprintf("%-5d%-6u%-7u%-6s%-10llu%-10llu%s\n", c->index, c->apic_id,
+                c->nr_ready, load, c->busy_ms, c->idle_ms,
+                c->online && c->current ? c->current->name : "(offline)");
+    }
+    thread_list_unlock(flags);
+}
+
+#define MEMBENCH_MAX_SIZE (1024 * 1024)
+#define MEMBENCH_MIN_MS 20
+
+// Run one primitive repeatedly for at least MEMBENCH_MIN_MS; returns MB/s
+static unsigned int membench_run(const kmem_variant *v, int op, char *dst,
+                                 char *src, unsigned int size) {
+    unsigned int total = 0;
+    unsigned int elapsed;
+    unsigned long long start = ktime_ms();
+    do {
+        for (int i = 0; i < 16; i++) {
+            if (op == 0) {
+                v->copy(dst, src, size);
+            } else if (op == 1) {
+                v->set(dst, i, size);
+            } else {
+                v->compare(dst, src, size);
+            }
+        }
+        total += 16 * size;
+        elapsed = (unsigned int)(ktime_ms() - start);
+    } while (elapsed < MEMBENCH_MIN_MS && total < 256 * 1024 * 1024);
+
+    return total / 1000 / (elapsed ? elapsed : 1);
+}
+
+void cmd_membench(char *args[]) {
+    (void)args;
+    static const char *ops[] = {"copy", "set", "cmp"};
+    static const unsigned int sizes[] = {64, 4096, 65536, MEMBENCH_MAX_SIZE};
+    static const char *size_names[] = {"64B", "4K", "64K", "1M"};
+
+    char *src = kmalloc(MEMBENCH_MAX_SIZE);
+    char *dst = kmalloc(MEMBENCH_MAX_SIZE);
+    if (src == NULL || dst == NULL) {
+        vga_puts("membench: out of memory\n");
+        kfree(src);
+        kfree(dst);
+        return;
+    }
+
+    kprintf("In use: %s\n", kmem_selected());
+
+    for (int op = 0; op < 3; op++) {
+        kprintf("%-12s", ops[op]);
+        for (int s = 0; s < 4; s++) {
+            kprintf("%-8s", size_names[s]);
+        }
+        kprintf("(MB/s)\n");
+
+        for (int i = 0; i < kmem_variant_count(); i++) {
+            const kmem_variant *v = kmem_variant_get(i);
+            if (!v->available) {
+                continue;
+            }
+            // Identical buffers so compares scan the whole length
+            kmemset(src, 0x5A, MEMBENCH_MAX_SIZE);
+            kmemset(dst, 0x5A, MEMBENCH_MAX_SIZE);
+
+            kprintf("  %-10s", v->name);
+            for (int s = 0; s < 4; s++) {
+                kprintf("%-8u", membench_run(v, op, dst, src, sizes[s]));
+            }
+            kprintf("\n");
+        }
+    }
+
+    kfree(src);
+    kfree(dst);
+}
+
+#define BLKBENCH_REGION (4 * 1024 * 1024)
+#define BLKBENCH_BLOCK 4096
+#define BLKBENCH_SECTORS (BLKBENCH_BLOCK / BLK_SECTOR_SIZE)
+#define BLKBENCH_BATCH 16
+#define BLKBENCH_MS 500
+
+static unsigned int blkbench_seed = 2463534242u;
+
+static unsigned int blkbench_random(void) {
+    blkbench_seed ^= blkbench_seed << 13;
+    blkbench_seed ^= blkbench_seed >> 17;
+    blkbench_seed ^= blkbench_seed << 5;
+    return blkbench_seed;
+}
+
+// Issue 4K requests over the first `blocks` blocks, `batch` per submit,
+// for at least BLKBENCH_MS. Writes store what region already holds for
+// each block, so the disk ends up as it was. Returns requests done, -1 on
+// an I/O error.
+static int blkbench_run(blkdev *dev, char *region, char *scratch,
+                        unsigned int blocks, int random, int write, int batch,
+                        unsigned int *elapsed) {
+    blk_request reqs[BLKBENCH_BATCH];
+    unsigned int next = 0;
+    int done = 0;
+    unsigned long long start = ktime_ms();
+    do {
+        for (int i = 0; i < batch; i++) {
+            unsigned int block = random ? blkbench_random() % blocks : next++ % blocks;
+            reqs[i].lba = block * BLKBENCH_SECTORS;
+            reqs[i].count = BLKBENCH_SECTORS;
+            reqs[i].buf = write ? region + block * BLKBENCH_BLOCK
+                                : scratch + i * BLKBENCH_BLOCK;
+            reqs[i].write = write;
+        }
+        if (blkdev_submit(dev, reqs, batch) != 0 ||
+            blkdev_wait(dev, reqs, batch) != 0) {
+            return -1;
+        }
+        done += batch;
+        *elapsed = (unsigned int)(ktime_ms() - start);
+    } while (*elapsed < BLKBENCH_MS);
+    return done;
+}
+
+void cmd_blkbench(char *args[]) {
+    static const char *phases[] = {"seq read", "rand read", "seq write", "rand write"};
+    static const int batches[] = {1, BLKBENCH_BATCH};
+
+    blkdev *dev = args[1] ? blkdev_find(args[1]) : blkdev_get(0);
+    if (dev == NULL) {
+        vga_puts("blkbench: no such block device\n");
+        return;
+    }
+    unsigned int blocks = dev->sectors / BLKBENCH_SECTORS;
+    if (blocks > BLKBENCH_REGION / BLKBENCH_BLOCK) {
+        blocks = BLKBENCH_REGION / BLKBENCH_BLOCK;
+    }
+    // The filesystem's blocks change under us and sit in its cache, so
+    // its device is only read: a snapshot put back could undo its writes
+    int phase_count = dev == diskfs_device() ? 2 : 4;
+    char *region = phase_count > 2 ? kmalloc(blocks * BLKBENCH_BLOCK) : NULL;
+    char *scratch = kmalloc(BLKBENCH_BATCH * BLKBENCH_BLOCK);
+    if (blocks == 0 || (phase_count > 2 && region == NULL) || scratch == NULL) {
+        vga_puts("blkbench: out of memory\n");
+        kfree(region);
+        kfree(scratch);
+        return;
+    }
+    // Snapshot the region so the write phases can put it back unchanged
+    for (unsigned int b = 0; phase_count > 2 && b < blocks; b += BLKBENCH_BATCH) {
+        unsigned int n = blocks - b < BLKBENCH_BATCH ? blocks - b : BLKBENCH_BATCH;
+        if (blkdev_read(dev, b * BLKBENCH_SECTORS, n * BLKBENCH_SECTORS,
+                        region + b * BLKBENCH_BLOCK) != 0) {
+            vga_puts("blkbench: read error\n");
+            kfree(region);
+            kfree(scratch);
+            return;
+        }
+    }
+
+    kprintf("%s: 4K requests over %u KB\n", dev->name, blocks * 4);
+    kprintf("%-12s%-20s%-20s\n", "", "1 per kick", "16 per kick");
+    kprintf("%-12s%-10s%-10s%-10s%-10s\n", "", "IOPS", "MB/s", "IOPS", "MB/s");
+    for (int p = 0; p < phase_count; p++) {
+        kprintf("%-12s", phases[p]);
+        for (int b = 0; b < 2; b++) {
+            unsigned int elapsed = 0;
+            int done = blkbench_run(dev, region, scratch, blocks, p & 1, p >> 1,
+                                    batches[b], &elapsed);
+            if (done < 0) {
+                kprintf("I/O error");
+                break;
+            }
+            unsigned int iops = (unsigned int)done * 1000 / elapsed;
+            unsigned int kb = iops * 4;
+            char mbs[16];
+            ksnprintf(mbs, sizeof(mbs), "%u.%u", kb / 1024, kb % 1024 * 10 / 1024);
+            kprintf("%-10u%-10s", iops, mbs);
+        }
+        kprintf("\n");
+        vga_flush();
+    }
+    if (phase_count == 2) {
+        kprintf("Writes skipped: %s holds the mounted filesystem\n", dev->name);
+    }
+
+    kfree(region);
+    kfree(scratch);
+}
+
+void cmd_sync(char *args[]) {
+    (void)args;
+    if (bcache_sync() != 0) {
+        vga_puts("sync: write error\n");
+    }
+}
+
+// part * 100 would overflow past 42 million
+static unsigned int percent(unsigned int part, unsigned int whole) {
+    if (whole >= 100000) {
+        return part / (whole / 100);
+    }
+    return whole ? part * 100 / whole : 0;
+}
+
+void cmd_cachestat(char *args[]) {
+    (void)args;
+    bcache_stats s;
+    bcache_get_stats(&s);
+    unsigned int kb = BCACHE_BLOCK_SIZE / 1024;
+    kprintf("Buffers:    %u of %u in use (%u KB of %u KB), %u dirty\n",
+            s.used, s.buffers, s.used * kb, s.buffers * kb, s.dirty);
+    kprintf("Reads:      %u hits, %u misses (%u%% hit rate)\n",
+            s.hits, s.misses, percent(s.hits, s.hits + s.misses));
+    kprintf("Read-ahead: %u blocks, %u used, %u evicted unused, window up to %u\n",
+            s.readahead, s.readahead_hits, s.readahead_wasted, s.readahead_limit);
+    kprintf("Write-back: %u blocks written, %u evictions\n",
+            s.writebacks, s.evictions);
+}
+
+void execute_command(char *input);
+
+// Thread body for "command &"; owns the heap copy of the command line
+static void run_background(void *arg) {
+    execute_command((char *)arg);
+    kfree(arg);
+}
+
+// Start "command &" on its own thread so the prompt comes straight back
+static int spawn_background(char *input) {
+    int len = kstrlen(input);
+    while (len > 0 && input[len - 1] == ' ') len--;
+    if (len == 0 || input[len - 1] != '&') {
+        return 0;
+    }
+    input[len - 1] = '\0';
+    
+    char *copy = kmalloc(len);
+    if (copy == NULL) {
+        vga_puts("Cannot start background job: out of memory\n");
+        return 1;
+    }
+    kstrcpy(copy, input);
+    
+    char name[THREAD_NAME_LEN];
+    int i = 0;
+    while (*input == ' ') input++;
+    while (input[i] && input[i] != ' ' && i < THREAD_NAME_LEN - 1) {
+        name[i] = input[i];
+        i++;
+    }
+    name[i] = '\0';
+    
+    thread *t = thread_create(name, run_background, copy, PRIORITY_NORMAL);
+    if (t == NULL) {
+        kfree(copy);
+        vga_puts("Cannot start background job: out of memory\n");
+        return 1;
+    }
+    
+    kprintf("[%d] started\n", t->id);
+    return 1;
+}
+
 // Find and execute command
 void execute_command(char *input) {
     char *args[MAX_ARGS];
@@ -304,13 +623,12 @@ void execute_command(char *input) {
     for (int i = 0; commands[i].name; i++) {
         if (kstreq(args[0], commands[i].name)) {
             commands[i].func(args);
+            vga_flush();
             return;
         }
     }
     
-    vga_puts("Unknown command: ");
-    vga_puts(args[0]);
-    vga_puts("\nType 'help' for available commands.\n");
+    kprintf("Unknown command: %s\nType 'help' for available commands.\n", args[0]);
 }
 
 void shell_run() {
@@ -321,6 +639,8 @@ void shell_run() {
     while (1) {
         vga_puts("ShOS Shell > ");
         kgets(input, MAX_INPUT);
-        execute_command(input);
+        if (!spawn_background(input)) {
+            execute_command(input);
+        }
     }
 }
\ No newline at end of file
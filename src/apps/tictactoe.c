@@ -1,6 +1,8 @@
 // tictactoe.c
 #include "vga.h"
 #include "klib.h"
+#include "keyboard.h"
+#include "strbuf.h"
 
 #define BOARD_SIZE 3
 #define CELL_WIDTH 5
@@ -84,20 +86,22 @@ void draw_cursor() {
 
 // Draw game status
 void draw_status() {
-    char status[50] = {0};
+    char status[50];
+    strbuf sb;
+    sb_init(&sb, status, sizeof(status));
     
     if (game_over) {
         if (winner == 0) {
-            kstrcpy(status, "X wins! Press 'r' to restart, 'q' to quit");
+            sb_append(&sb, "X wins! Press 'r' to restart, 'q' to quit");
         } else if (winner == 1) {
-            kstrcpy(status, "O wins! Press 'r' to restart, 'q' to quit");
+            sb_append(&sb, "O wins! Press 'r' to restart, 'q' to quit");
         } else if (winner == 2) {
-            kstrcpy(status, "Draw! Press 'r' to restart, 'q' to quit");
+            sb_append(&sb, "Draw! Press 'r' to restart, 'q' to quit");
         }
     } else {
-        kstrcpy(status, "Player: ");
-        kstrcat(status, current_player == 0 ? "X" : "O");
-        kstrcat(status, " - Arrows: move, Space: mark");
+        sb_append(&sb, "Player: ");
+        sb_append_char(&sb, current_player == 0 ? 'X' : 'O');
+        sb_append(&sb, " - Arrows: move, Space: mark");
     }
     
     // Center the status message
@@ -223,27 +227,22 @@ void tictactoe_game() {
     
     int quit = 0;
     while (!quit) {
-        // Check if a key is available
-        if ((inb(0x64) & 1) != 0) {
-            unsigned char scancode = inb(0x60);
-
-            // Handle the input
-            handle_input(scancode);
-
-            // Quit only when game is over and 'Q' is pressed
-            if (scancode == 0x10 && game_over) { // 'Q'
-                quit = 1;
-            }
-        }
-
         // Clear old frame and redraw everything
         clear_game_area();
         draw_board();
         draw_cursor();
         draw_status();
 
-        // Simple delay to avoid flickering
-        for (volatile int i = 0; i < 50000; i++);
+        // Nothing changes until a key arrives, so sleep until then
+        unsigned char scancode = keyboard_read_scancode();
+
+        // Handle the input
+        handle_input(scancode);
+
+        // Quit only when game is over and 'Q' is pressed
+        if (scancode == 0x10 && game_over) { // 'Q'
+            quit = 1;
+        }
     }
     
     // Return to shell
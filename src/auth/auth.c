@@ -2,7 +2,10 @@
 #include "auth.h"
 #include "vga.h"
 #include "klib.h"
-#include "fs.h"
+#include "timer.h"
+#include "file.h"
+#include "kprintf.h"
+#include "strbuf.h"
 
 static User users[MAX_USERS];
 static int user_count = 0;
@@ -25,87 +28,96 @@ void auth_init(void) {
     }
 }
 
-// Simulated file save operation
+// Write every account to the users file. It lands on disk when one is
+// mounted, and otherwise lasts only until reboot.
 int auth_save_users(void) {
-    // In a real OS, this would write to actual disk
-    // For now, we'll create a virtual file in our RAM filesystem
-    
     // Create a string representation of all users
-    char file_content[1024] = {0};
+    char file_content[AUTH_FILE_MAX];
+    strbuf sb;
+    sb_init(&sb, file_content, sizeof(file_content));
     
     for (int i = 0; i < user_count; i++) {
-        kstrcat(file_content, users[i].username);
-        kstrcat(file_content, ":");
-        kstrcat(file_content, users[i].password);
-        kstrcat(file_content, ":");
-        
-        char admin_str[4];
-        int_to_str(users[i].is_admin, admin_str);
-        kstrcat(file_content, admin_str);
-        kstrcat(file_content, "\n");
+        sb_append(&sb, users[i].username);
+        sb_append_char(&sb, ':');
+        sb_append(&sb, users[i].password);
+        sb_append_char(&sb, ':');
+        sb_append_int(&sb, users[i].is_admin);
+        sb_append_char(&sb, '\n');
+    }
+    if (sb.truncated) {
+        return 0; // A partial users file would lose accounts
     }
     
     // Create or overwrite the users file
-    fs_node *file = fs_find_file(AUTH_FILE);
-    if (file == NULL) {
-        fs_touch(AUTH_FILE);
-        file = fs_find_file(AUTH_FILE);
+    int fd = fs_open(AUTH_FILE, FS_O_WRITE | FS_O_CREATE | FS_O_TRUNC);
+    if (fd < 0) {
+        return 0; // Failure
     }
+    int written = fs_write_at(fd, 0, file_content, sb.len);
+    fs_close(fd);
+    return written == (int)sb.len ? 1 : 0;
+}
+
+// Parse one "username:password:is_admin" line, split in place
+static void parse_user_line(char *line) {
+    char *parts[3];
+    int part_count = 0;
+    char *token = line;
     
-    if (file != NULL) {
-        file->data = file_content;
-        file->size = kstrlen(file_content);
-        return 1; // Success
+    while (token && part_count < 3) {
+        parts[part_count++] = token;
+        token = kstrchr(token, ':');
+        if (token) {
+            *token = '\0';
+            token++;
+        }
     }
     
-    return 0; // Failure
+    if (part_count == 3) {
+        // Store user data
+        kstrcpy(users[user_count].username, parts[0]);
+        kstrcpy(users[user_count].password, parts[1]);
+        users[user_count].is_admin = str_to_int(parts[2]);
+        user_count++;
+    }
 }
 
-// Simulated file load operation
+// Read the accounts back from the users file, if there is one
 int auth_load_users(void) {
     // Look for users file
-    fs_node *file = fs_find_file(AUTH_FILE);
-    if (file == NULL || file->data == NULL) {
+    int fd = fs_open(AUTH_FILE, FS_O_READ);
+    if (fd < 0) {
         return 0; // File doesn't exist
     }
     
-    // Parse file content
-    char *content = file->data;
-    // int line_num = 0;
-    char *line_start = content;
+    // Stream the file a chunk at a time; only the current line is kept
+    char chunk[128];
+    char line[AUTH_LINE_MAX];
+    int line_len = 0;
+    int overlong = 0;
+    int n;
     
     user_count = 0;
     
-    while (*content && user_count < MAX_USERS) {
-        if (*content == '\n') {
-            *content = '\0'; // Terminate line
-            
-            // Parse line: username:password:is_admin
-            char *parts[3];
-            int part_count = 0;
-            char *token = line_start;
-            
-            while (token && part_count < 3) {
-                parts[part_count++] = token;
-                token = kstrchr(token, ':');
-                if (token) {
-                    *token = '\0';
-                    token++;
+    while (user_count < MAX_USERS && (n = fs_read(fd, chunk, sizeof(chunk))) > 0) {
+        for (int i = 0; i < n && user_count < MAX_USERS; i++) {
+            if (chunk[i] != '\n') {
+                if (line_len < AUTH_LINE_MAX - 1) {
+                    line[line_len++] = chunk[i];
+                } else {
+                    overlong = 1;
                 }
+                continue;
             }
-            
-            if (part_count == 3) {
-                // Store user data
-                kstrcpy(users[user_count].username, parts[0]);
-                kstrcpy(users[user_count].password, parts[1]);
-                users[user_count].is_admin = str_to_int(parts[2]);
-                user_count++;
+            line[line_len] = '\0';
+            if (!overlong) {
+                parse_user_line(line);
             }
-            
-            line_start = content + 1;
+            line_len = 0;
+            overlong = 0;
         }
-        content++;
     }
+    fs_close(fd);
     
     return user_count > 0 ? 1 : 0;
 }
@@ -158,28 +170,22 @@ int auth_login(void) {
         
         // Check credentials
         if (auth_check_credentials(username, password)) {
-            vga_puts("\nLogin successful! Welcome, ");
-            vga_puts(username);
-            vga_puts("!\n\n");
+            kprintf("\nLogin successful! Welcome, %s!\n\n", username);
             
             // Show welcome message with some delay
-            for (volatile int j = 0; j < 2000000; j++);
+            ksleep(2000);
             
             return 1;
         } else {
             attempts++;
-            vga_puts("\nInvalid credentials. Attempts remaining: ");
-            char attempts_str[4];
-            int_to_str(3 - attempts, attempts_str);
-            vga_puts(attempts_str);
-            vga_puts("\n\n");
+            kprintf("\nInvalid credentials. Attempts remaining: %d\n\n", 3 - attempts);
             
             // Clear input fields
             username[0] = '\0';
             password[0] = '\0';
             
             // Add delay before clearing screen
-            for (volatile int j = 0; j < 1000000; j++);
+            ksleep(1000);
             
             if (attempts < 3) {
                 vga_clear();
@@ -194,7 +200,7 @@ int auth_login(void) {
 int auth_register(void) {
     if (user_count >= MAX_USERS) {
         vga_puts("Maximum user limit reached.\n");
-        for (volatile int j = 0; j < 1000000; j++);
+        ksleep(1000);
         return 0;
     }
     
@@ -214,7 +220,7 @@ int auth_register(void) {
     for (int i = 0; i < user_count; i++) {
         if (kstreq(users[i].username, username)) {
             vga_puts("Username already exists.\n");
-            for (volatile int j = 0; j < 1000000; j++);
+            ksleep(1000);
             return 0;
         }
     }
@@ -260,7 +266,7 @@ int auth_register(void) {
     // Check if passwords match
     if (!kstreq(password, confirm)) {
         vga_puts("Passwords do not match.\n");
-        for (volatile int j = 0; j < 1000000; j++);
+        ksleep(1000);
         return 0;
     }
     
@@ -3,6 +3,7 @@
 #include "auth.h"
 #include "vga.h"
 #include "klib.h"
+#include "timer.h"
 
 void login_show_menu(void) {
     vga_clear();
@@ -35,7 +36,7 @@ int login_handle_choice(void) {
         return 0;
     } else {
         vga_puts("Invalid choice. Please try again.\n");
-        for (volatile int i = 0; i < 1000000; i++);
+        ksleep(1000);
         return 0; // Show menu again
     }
 }
\ No newline at end of file
@@ -1,27 +1,60 @@
 ; boot.asm
+MB_FLAGS equ 0x03   ; Page-align modules, provide memory map
+KERNEL_VIRT_BASE equ 0xC0000000
+PDE_4M equ 0x83     ; Present, writable, 4 MiB page
+
 section .multiboot
 align 4
 dd 0x1BADB002       ; Magic number
-dd 0x00             ; Flags
-dd -(0x1BADB002 + 0x00) ; Checksum
+dd MB_FLAGS         ; Flags
+dd -(0x1BADB002 + MB_FLAGS) ; Checksum
 
-section .text
+; The loader jumps here with paging off, so this code is linked at its
+; physical address. It maps the first 8 MiB both at 0 and at
+; KERNEL_VIRT_BASE with 4 MiB pages, then continues in the higher half.
+section .boot progbits alloc exec nowrite align=16
 global start
 extern kmain        ; Kernel entry point
 bits 32  ; 32-bit protected mode
 
 start:
+    mov ecx, cr4
+    or ecx, 0x10       ; CR4.PSE: allow 4 MiB pages
+    mov cr4, ecx
+    mov ecx, boot_page_directory - KERNEL_VIRT_BASE
+    mov cr3, ecx
+    mov ecx, cr0
+    or ecx, 0x80000000 ; CR0.PG
+    mov cr0, ecx
+    mov ecx, higher_half
+    jmp ecx            ; Absolute jump into the higher-half mapping
+
+section .text
+higher_half:
     mov esp, stack_top ; Set up stack
+    push ebx           ; Multiboot info pointer (physical, identity mapped)
+    push eax           ; Multiboot magic
     call kmain         ; Call kernel
     cli                ; Disable interrupts
 .halt:
     hlt                ; Halt CPU
     jmp .halt
 
+section .data
+align 4096
+global boot_page_directory
+boot_page_directory:
+    dd 0x00000000 | PDE_4M
+    dd 0x00400000 | PDE_4M
+    times (KERNEL_VIRT_BASE >> 22) - 2 dd 0
+    dd 0x00000000 | PDE_4M
+    dd 0x00400000 | PDE_4M
+    times 1024 - (KERNEL_VIRT_BASE >> 22) - 2 dd 0
+
 section .bss
 align 16
 stack_bottom:
 resb 16384          ; 16 KB stack
 stack_top:
 
-section .note.GNU-stack ; Prevent executable stack
\ No newline at end of file
+section .note.GNU-stack ; Prevent executable stack
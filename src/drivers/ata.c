@@ -0,0 +1,292 @@
+// ata.c
+#include "ata.h"
+#include "klib.h"
+#include "kprintf.h"
+#include "paging.h"
+#include "sched.h"
+#include "pci.h"
+#include "blkdev.h"
+
+#define ATA_IO 0x1F0            // Primary channel command block
+#define ATA_CTRL 0x3F6          // Device control / alternate status
+
+// Register offsets from ATA_IO
+#define ATA_DATA 0
+#define ATA_ERROR 1
+#define ATA_COUNT 2
+#define ATA_LBA0 3
+#define ATA_LBA1 4
+#define ATA_LBA2 5
+#define ATA_DRIVE 6
+#define ATA_STATUS 7            // Command on write
+
+#define ATA_SR_ERR 0x01
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_DF 0x20
+#define ATA_SR_BSY 0x80
+#define ATA_CTRL_NIEN 0x02      // Completion is polled, not signalled
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_FLUSH 0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+#define ATA_DRIVE_LBA 0xE0      // Master, LBA addressing
+#define ATA_TIMEOUT 10000000
+
+// Bus-master IDE registers, primary channel, from PCI BAR4
+#define BM_COMMAND 0
+#define BM_STATUS 2
+#define BM_PRDT 4
+#define BM_CMD_START 0x01
+#define BM_CMD_READ 0x08        // Device to memory
+#define BM_SR_ACTIVE 0x01
+#define BM_SR_ERR 0x02
+#define BM_SR_IRQ 0x04
+
+#define PRD_LAST 0x8000
+#define PRD_ENTRIES 8
+#define DMA_BOUNDARY 0x10000    // A PRD entry may not cross 64 KB
+
+typedef struct {
+    unsigned int addr;
+    unsigned short bytes;       // 0 means 64 KB
+    unsigned short flags;
+} __attribute__((packed)) prd_entry;
+
+// Aligned to its own size, so the table never crosses a 64 KB boundary
+static prd_entry prdt[PRD_ENTRIES] __attribute__((aligned(sizeof(prd_entry) * PRD_ENTRIES)));
+static unsigned short bm_base;  // 0 without a bus-master controller
+static unsigned int sectors;
+static int present;
+static blkdev ata_dev;
+// Held across whole polled transfers, so waiters sleep rather than spin
+static mutex ata_lock = MUTEX_INIT;
+
+// BSY clear; errors are left to the caller, as they stick until the
+// next command is issued
+static int wait_idle(void) {
+    for (int i = 0; i < ATA_TIMEOUT; i++) {
+        if (!(inb(ATA_IO + ATA_STATUS) & ATA_SR_BSY)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int wait_ready(void) {
+    for (int i = 0; i < ATA_TIMEOUT; i++) {
+        unsigned char status = inb(ATA_IO + ATA_STATUS);
+        if (!(status & ATA_SR_BSY)) {
+            return status & (ATA_SR_ERR | ATA_SR_DF) ? -1 : 0;
+        }
+    }
+    return -1;
+}
+
+static int wait_drq(void) {
+    for (int i = 0; i < ATA_TIMEOUT; i++) {
+        unsigned char status = inb(ATA_IO + ATA_STATUS);
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+            return -1;
+        }
+        if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRQ)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void issue(unsigned char command, unsigned int lba, unsigned int count) {
+    outb(ATA_IO + ATA_DRIVE, ATA_DRIVE_LBA | ((lba >> 24) & 0x0F));
+    outb(ATA_IO + ATA_COUNT, count & 0xFF);   // 0 means 256
+    outb(ATA_IO + ATA_LBA0, lba & 0xFF);
+    outb(ATA_IO + ATA_LBA1, (lba >> 8) & 0xFF);
+    outb(ATA_IO + ATA_LBA2, (lba >> 16) & 0xFF);
+    outb(ATA_IO + ATA_STATUS, command);
+}
+
+static int pio_read(unsigned int lba, unsigned int count, unsigned short *buf) {
+    issue(ATA_CMD_READ_PIO, lba, count);
+    for (unsigned int s = 0; s < count; s++) {
+        if (wait_drq() != 0) {
+            return -1;
+        }
+        for (int i = 0; i < ATA_SECTOR_SIZE / 2; i++) {
+            *buf++ = inw(ATA_IO + ATA_DATA);
+        }
+    }
+    return 0;
+}
+
+static int pio_write(unsigned int lba, unsigned int count, const unsigned short *buf) {
+    issue(ATA_CMD_WRITE_PIO, lba, count);
+    for (unsigned int s = 0; s < count; s++) {
+        if (wait_drq() != 0) {
+            return -1;
+        }
+        for (int i = 0; i < ATA_SECTOR_SIZE / 2; i++) {
+            outw(ATA_IO + ATA_DATA, *buf++);
+        }
+    }
+    if (wait_ready() != 0) {
+        return -1;
+    }
+    outb(ATA_IO + ATA_STATUS, ATA_CMD_FLUSH);
+    return wait_ready();
+}
+
+// Describe buf to the controller, split wherever it crosses 64 KB
+static int prdt_build(const void *buf, unsigned int bytes) {
+    unsigned int phys = virt_to_phys(buf);
+    int n = 0;
+    while (bytes > 0) {
+        if (n == PRD_ENTRIES) {
+            return -1;
+        }
+        unsigned int chunk = DMA_BOUNDARY - (phys & (DMA_BOUNDARY - 1));
+        if (chunk > bytes) chunk = bytes;
+        prdt[n].addr = phys;
+        prdt[n].bytes = chunk & 0xFFFF;
+        prdt[n].flags = 0;
+        phys += chunk;
+        bytes -= chunk;
+        n++;
+    }
+    prdt[n - 1].flags = PRD_LAST;
+    return 0;
+}
+
+static int dma_transfer(unsigned int lba, unsigned int count, void *buf, int write) {
+    if (prdt_build(buf, count * ATA_SECTOR_SIZE) != 0) {
+        return -1;
+    }
+    unsigned char direction = write ? 0 : BM_CMD_READ;
+    outl(bm_base + BM_PRDT, virt_to_phys(prdt));
+    outb(bm_base + BM_COMMAND, direction);
+    outb(bm_base + BM_STATUS, BM_SR_ERR | BM_SR_IRQ);   // Write 1 to clear
+
+    issue(write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA, lba, count);
+    outb(bm_base + BM_COMMAND, direction | BM_CMD_START);
+
+    // The engine drops ACTIVE once the PRD list is exhausted
+    int result = -1;
+    for (int i = 0; i < ATA_TIMEOUT; i++) {
+        unsigned char status = inb(bm_base + BM_STATUS);
+        if (status & BM_SR_ERR) {
+            break;
+        }
+        if (!(status & BM_SR_ACTIVE)) {
+            result = 0;
+            break;
+        }
+    }
+    outb(bm_base + BM_COMMAND, 0);
+    outb(bm_base + BM_STATUS, BM_SR_ERR | BM_SR_IRQ);
+    if (wait_ready() != 0) {
+        return -1;
+    }
+    if (result == 0 && write) {
+        outb(ATA_IO + ATA_STATUS, ATA_CMD_FLUSH);
+        result = wait_ready();
+    }
+    return result;
+}
+
+// Bus-master I/O base of the IDE controller, with bus mastering switched
+// on; 0 if there is none
+static unsigned short find_bus_master(void) {
+    pci_device *ide = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE);
+    if (ide == 0 || pci_bar_io(ide, 4) == 0) {
+        return 0;
+    }
+    pci_enable(ide, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+    return pci_bar_io(ide, 4);
+}
+
+static int transfer(unsigned int lba, unsigned int count, void *buf, int write) {
+    if (!present || lba + count > sectors || lba + count < lba) {
+        return -1;
+    }
+    char *p = buf;
+    mutex_lock(&ata_lock);
+    int result = 0;
+    while (count > 0 && result == 0) {
+        unsigned int n = count > ATA_MAX_TRANSFER ? ATA_MAX_TRANSFER : count;
+        if (wait_idle() != 0) {
+            result = -1;
+        } else if (n > 1 && bm_base != 0) {
+            result = dma_transfer(lba, n, p, write);
+        } else if (write) {
+            result = pio_write(lba, n, (const unsigned short *)p);
+        } else {
+            result = pio_read(lba, n, (unsigned short *)p);
+        }
+        lba += n;
+        count -= n;
+        p += n * ATA_SECTOR_SIZE;
+    }
+    mutex_unlock(&ata_lock);
+    return result;
+}
+
+static int ata_submit(blkdev *dev, blk_request *reqs, int count) {
+    for (int i = 0; i < count; i++) {
+        blkdev_complete(dev, &reqs[i], transfer(reqs[i].lba, reqs[i].count,
+                                                reqs[i].buf, reqs[i].write));
+    }
+    return 0;
+}
+
+static void ata_poll(blkdev *dev) {
+    (void)dev; // Nothing is ever left in flight
+}
+
+int ata_init(void) {
+    // Nothing attached: the bus floats high
+    if (inb(ATA_IO + ATA_STATUS) == 0xFF) {
+        return -1;
+    }
+    outb(ATA_CTRL, ATA_CTRL_NIEN);
+    outb(ATA_IO + ATA_DRIVE, 0xA0);
+    outb(ATA_IO + ATA_COUNT, 0);
+    outb(ATA_IO + ATA_LBA0, 0);
+    outb(ATA_IO + ATA_LBA1, 0);
+    outb(ATA_IO + ATA_LBA2, 0);
+    outb(ATA_IO + ATA_STATUS, ATA_CMD_IDENTIFY);
+    if (inb(ATA_IO + ATA_STATUS) == 0) {
+        return -1;
+    }
+    if (wait_ready() != 0) {
+        return -1;
+    }
+    // ATAPI and SATA devices answer with a signature here
+    if (inb(ATA_IO + ATA_LBA1) != 0 || inb(ATA_IO + ATA_LBA2) != 0) {
+        return -1;
+    }
+    if (wait_drq() != 0) {
+        return -1;
+    }
+    unsigned short identify[ATA_SECTOR_SIZE / 2];
+    for (int i = 0; i < ATA_SECTOR_SIZE / 2; i++) {
+        identify[i] = inw(ATA_IO + ATA_DATA);
+    }
+    sectors = identify[60] | ((unsigned int)identify[61] << 16);
+    if (sectors == 0) {
+        return -1; // CHS only
+    }
+
+    bm_base = find_bus_master();
+    present = 1;
+    ata_dev.name = "ata0";
+    ata_dev.sectors = sectors;
+    ata_dev.max_batch = 1;
+    ata_dev.submit = ata_submit;
+    ata_dev.poll = ata_poll;
+    blkdev_register(&ata_dev);
+    kprintf("ATA: %u sectors (%u MB), %s\n", sectors, sectors / 2048,
+            bm_base ? "DMA" : "PIO only");
+    return 0;
+}
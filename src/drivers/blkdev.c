@@ -0,0 +1,94 @@
+// blkdev.c
+#include "blkdev.h"
+#include "klib.h"
+
+#define EFLAGS_IF 0x200
+
+static blkdev *devices[BLKDEV_MAX];
+static int device_count;
+
+int blkdev_register(blkdev *dev) {
+    if (device_count == BLKDEV_MAX) {
+        return -1;
+    }
+    wait_queue_init(&dev->done);
+    devices[device_count++] = dev;
+    return 0;
+}
+
+int blkdev_count(void) {
+    return device_count;
+}
+
+blkdev *blkdev_get(int index) {
+    return index >= 0 && index < device_count ? devices[index] : 0;
+}
+
+blkdev *blkdev_find(const char *name) {
+    for (int i = 0; i < device_count; i++) {
+        if (kstreq(devices[i]->name, name)) {
+            return devices[i];
+        }
+    }
+    return 0;
+}
+
+int blkdev_submit(blkdev *dev, blk_request *reqs, int count) {
+    for (int i = 0; i < count; i++) {
+        if (reqs[i].count == 0 || reqs[i].lba + reqs[i].count > dev->sectors ||
+            reqs[i].lba + reqs[i].count < reqs[i].lba) {
+            return -1;
+        }
+        reqs[i].status = BLK_PENDING;
+    }
+    return dev->submit(dev, reqs, count);
+}
+
+int blkdev_wait(blkdev *dev, blk_request *reqs, int count) {
+    int result = 0;
+    unsigned int flags = spin_lock_irqsave(&dev->done.lock);
+    for (int i = 0; i < count; i++) {
+        while (reqs[i].status == BLK_PENDING) {
+            if (flags & EFLAGS_IF) {
+                wait_queue_sleep(&dev->done);
+            } else {
+                // Nobody would wake us: early boot or a panic path
+                spin_unlock(&dev->done.lock);
+                dev->poll(dev);
+                spin_lock(&dev->done.lock);
+            }
+        }
+        if (reqs[i].status != 0) {
+            result = -1;
+        }
+    }
+    spin_unlock_irqrestore(&dev->done.lock, flags);
+    return result;
+}
+
+void blkdev_complete(blkdev *dev, blk_request *req, int status) {
+    req->status = status;
+    wait_queue_wake_all(&dev->done);
+}
+
+static int transfer(blkdev *dev, unsigned int lba, unsigned int count,
+                    void *buf, int write) {
+    blk_request req;
+    req.lba = lba;
+    req.count = count;
+    req.buf = buf;
+    req.write = write;
+    if (blkdev_submit(dev, &req, 1) != 0) {
+        return -1;
+    }
+    return blkdev_wait(dev, &req, 1);
+}
+
+int blkdev_read(blkdev *dev, unsigned int lba, unsigned int count, void *buf) {
+    return transfer(dev, lba, count, buf, 0);
+}
+
+int blkdev_write(blkdev *dev, unsigned int lba, unsigned int count,
+                 const void *buf) {
+    return transfer(dev, lba, count, (void *)buf, 1);
+}
@@ -0,0 +1,230 @@
+// keyboard.c
+#include "keyboard.h"
+#include "idt.h"
+#include "klib.h"
+#include "sched.h"
+#include "vga.h"
+
+#define SC_EXTENDED 0xE0
+#define SC_LSHIFT 0x2A
+#define SC_RSHIFT 0x36
+#define SC_ALT 0x38         // Right Alt is the same code after SC_EXTENDED
+#define SC_F1 0x3B
+#define SC_RELEASE 0x80
+#define SC_PAGE_UP 0x49     // After SC_EXTENDED
+#define SC_PAGE_DOWN 0x51
+#define SC_CTRL 0x1D
+#define SC_ESCAPE 0x01
+#define SC_ARROW_UP 0x48    // After SC_EXTENDED
+#define SC_ARROW_DOWN 0x50
+#define SC_ARROW_LEFT 0x4B
+#define SC_ARROW_RIGHT 0x4D
+
+// Scancode set 1 to ASCII, unshifted and with Shift held
+const char keyboard_keymap[128] = {
+    0,   0,   '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
+    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
+    0,   'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`', 0,   '\\',
+    'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,   '*',  0,   ' ', 0,
+};
+
+static const char keymap_shift[128] = {
+    0,   0,   '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', 0,
+    0,   'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', 0,
+    0,   'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~', 0,   '|',
+    'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0,   0,    0,   0,   0,
+};
+
+// One input queue per virtual console; keys go to the console on screen.
+// Each is a single-producer/single-consumer ring: the IRQ1 handler only
+// advances head, readers only advance tail (under the wait queue lock),
+// so the producer never needs a lock.
+typedef struct {
+    volatile unsigned char buffer[KEYBOARD_BUFFER_SIZE];
+    volatile unsigned int head;
+    volatile unsigned int tail;
+    wait_queue waiters;
+} key_queue;
+
+static key_queue queues[VGA_CONSOLES];
+
+// Modifier state seen by the IRQ handler, for console hotkeys
+static int shift_down = 0;
+static int alt_down = 0;
+static int extended_pending = 0;
+
+static void buffer_push(key_queue *q, unsigned char scancode) {
+    unsigned int head = q->head;
+
+    // Drop the key when the buffer is full rather than overwrite
+    if (head - q->tail < KEYBOARD_BUFFER_SIZE) {
+        q->buffer[head & (KEYBOARD_BUFFER_SIZE - 1)] = scancode;
+        asm volatile ("" ::: "memory");
+        q->head = head + 1;
+    }
+}
+
+// Console hotkeys are handled here and never reach readers. Returns 1 if
+// the key was consumed.
+static int handle_hotkey(unsigned char scancode, int extended) {
+    unsigned char key = scancode & ~SC_RELEASE;
+    int pressed = !(scancode & SC_RELEASE);
+
+    // Extended shift codes are fake shifts some keyboards wrap around
+    // navigation keys; only the real ones change state
+    if (!extended && (key == SC_LSHIFT || key == SC_RSHIFT)) {
+        shift_down = pressed;
+        return 0;
+    }
+    if (key == SC_ALT) {
+        alt_down = pressed;
+        return 0;
+    }
+    if (extended && shift_down && (key == SC_PAGE_UP || key == SC_PAGE_DOWN)) {
+        if (pressed) {
+            vga_scroll_view(key == SC_PAGE_UP ? VGA_HEIGHT - 1 : -(VGA_HEIGHT - 1));
+        }
+        return 1;
+    }
+    if (!extended && alt_down && key >= SC_F1 && key < SC_F1 + VGA_CONSOLES) {
+        if (pressed) {
+            vga_console_switch(key - SC_F1);
+        }
+        return 1;
+    }
+    // Any other key press returns to the live screen
+    if (pressed) {
+        vga_scroll_live();
+    }
+    return 0;
+}
+
+static void keyboard_irq(interrupt_frame *frame) {
+    (void)frame;
+    unsigned char scancode = inb(KEYBOARD_DATA_PORT);
+
+    // Hold an 0xE0 prefix back until we know whether its key is a hotkey
+    if (scancode == SC_EXTENDED) {
+        extended_pending = 1;
+        return;
+    }
+    int extended = extended_pending;
+    extended_pending = 0;
+
+    if (!handle_hotkey(scancode, extended)) {
+        key_queue *q = &queues[vga_console_active()];
+        if (extended) {
+            buffer_push(q, SC_EXTENDED);
+        }
+        buffer_push(q, scancode);
+        wait_queue_wake_all(&q->waiters);
+    }
+}
+
+void keyboard_init(void) {
+    for (int i = 0; i < VGA_CONSOLES; i++) {
+        wait_queue_init(&queues[i].waiters);
+    }
+
+    // Drain anything the controller latched before the IRQ was hooked
+    while (inb(0x64) & 1) {
+        inb(KEYBOARD_DATA_PORT);
+    }
+    irq_register(IRQ_KEYBOARD, keyboard_irq);
+}
+
+// Input from other devices (the serial console) joins the same queues.
+// It arrives from a PIC interrupt like IRQ1, on the boot CPU with
+// interrupts off, so each ring still has one producer at a time.
+void keyboard_inject(int console, unsigned char scancode) {
+    if (console < 0 || console >= VGA_CONSOLES) {
+        return;
+    }
+    buffer_push(&queues[console], scancode);
+    wait_queue_wake_all(&queues[console].waiters);
+}
+
+static void inject_key(int console, unsigned char modifier, unsigned char key) {
+    if (modifier) keyboard_inject(console, modifier);
+    keyboard_inject(console, key);
+    keyboard_inject(console, key | SC_RELEASE);
+    if (modifier) keyboard_inject(console, modifier | SC_RELEASE);
+}
+
+// Type an ASCII character as the key presses that would produce it;
+// control characters become Ctrl+letter. Unknown bytes are dropped.
+void keyboard_inject_char(int console, char c) {
+    unsigned char ch = (unsigned char)c;
+    if (ch == 0) {
+        return;
+    }
+    if (ch == 0x7F) {
+        ch = '\b';    // DEL is what most terminals send for Backspace
+    }
+    if (ch == 0x1B) {
+        inject_key(console, 0, SC_ESCAPE);
+        return;
+    }
+    for (unsigned char sc = 0; sc < 0x80; sc++) {
+        if (keyboard_keymap[sc] == ch) {
+            inject_key(console, 0, sc);
+            return;
+        }
+        if (keymap_shift[sc] == ch) {
+            inject_key(console, SC_LSHIFT, sc);
+            return;
+        }
+    }
+    if (ch >= 1 && ch <= 26) {
+        for (unsigned char sc = 0; sc < 0x80; sc++) {
+            if (keyboard_keymap[sc] == 'a' + ch - 1) {
+                inject_key(console, SC_CTRL, sc);
+                return;
+            }
+        }
+    }
+}
+
+// Final byte of an ANSI cursor key sequence (ESC [ A..D)
+void keyboard_inject_arrow(int console, char code) {
+    static const unsigned char arrows[4] = {
+        SC_ARROW_UP, SC_ARROW_DOWN, SC_ARROW_RIGHT, SC_ARROW_LEFT
+    };
+    if (code < 'A' || code > 'D') {
+        return;
+    }
+    unsigned char key = arrows[code - 'A'];
+    keyboard_inject(console, SC_EXTENDED);
+    keyboard_inject(console, key);
+    keyboard_inject(console, SC_EXTENDED);
+    keyboard_inject(console, key | SC_RELEASE);
+}
+
+static int queue_poll(key_queue *q) {
+    unsigned int tail = q->tail;
+    if (tail == q->head) {
+        return -1;
+    }
+    unsigned char scancode = q->buffer[tail & (KEYBOARD_BUFFER_SIZE - 1)];
+    asm volatile ("" ::: "memory");
+    q->tail = tail + 1;
+    return scancode;
+}
+
+int keyboard_poll_scancode(void) {
+    return queue_poll(&queues[vga_console_current()]);
+}
+
+unsigned char keyboard_read_scancode(void) {
+    key_queue *q = &queues[vga_console_current()];
+    int scancode;
+
+    // Test and sleep under the queue lock so a wakeup from IRQ1 (possibly
+    // on another CPU) cannot slip in between the empty check and sleeping
+    unsigned int flags = spin_lock_irqsave(&q->waiters.lock);
+    while ((scancode = queue_poll(q)) < 0) {
+        wait_queue_sleep(&q->waiters);
+    }
+    spin_unlock_irqrestore(&q->waiters.lock, flags);
+    return (unsigned char)scancode;
+}
@@ -0,0 +1,125 @@
+// pci.c
+#include "pci.h"
+#include "klib.h"
+
+static pci_device devices[PCI_MAX_DEVICES];
+static int device_count;
+
+static unsigned int config_address(unsigned int bus, unsigned int dev,
+                                   unsigned int fn, unsigned int offset) {
+    return 0x80000000 | (bus << 16) | (dev << 11) | (fn << 8) | (offset & 0xFC);
+}
+
+static unsigned int config_read(unsigned int bus, unsigned int dev,
+                                unsigned int fn, unsigned int offset) {
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, dev, fn, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+unsigned int pci_read32(const pci_device *d, unsigned int offset) {
+    return config_read(d->bus, d->dev, d->fn, offset);
+}
+
+void pci_write32(const pci_device *d, unsigned int offset, unsigned int value) {
+    outl(PCI_CONFIG_ADDRESS, config_address(d->bus, d->dev, d->fn, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+static void scan_bus(unsigned int bus);
+
+static void add_function(unsigned int bus, unsigned int dev, unsigned int fn,
+                         unsigned int id) {
+    unsigned int class_reg = config_read(bus, dev, fn, PCI_CLASS);
+    unsigned char class_code = class_reg >> 24;
+    unsigned char subclass = (class_reg >> 16) & 0xFF;
+
+    if (class_code == PCI_CLASS_BRIDGE && subclass == PCI_SUBCLASS_PCI_BRIDGE) {
+        unsigned int secondary = (config_read(bus, dev, fn, PCI_BUS_NUMBERS) >> 8) & 0xFF;
+        if (secondary > bus) {
+            scan_bus(secondary);
+        }
+        return;
+    }
+    if (device_count == PCI_MAX_DEVICES) {
+        return;
+    }
+
+    pci_device *d = &devices[device_count++];
+    d->bus = bus;
+    d->dev = dev;
+    d->fn = fn;
+    d->vendor = id & 0xFFFF;
+    d->device = id >> 16;
+    d->class_code = class_code;
+    d->subclass = subclass;
+    d->prog_if = (class_reg >> 8) & 0xFF;
+    d->irq = config_read(bus, dev, fn, PCI_INTERRUPT_LINE) & 0xFF;
+    for (int i = 0; i < 6; i++) {
+        d->bar[i] = config_read(bus, dev, fn, PCI_BAR0 + i * 4);
+    }
+}
+
+static void scan_bus(unsigned int bus) {
+    for (unsigned int dev = 0; dev < 32; dev++) {
+        unsigned int id = config_read(bus, dev, 0, PCI_ID);
+        if ((id & 0xFFFF) == 0xFFFF) {
+            continue; // Empty slot
+        }
+        add_function(bus, dev, 0, id);
+        // Bit 7 of the header type marks a multi-function device
+        unsigned int header = config_read(bus, dev, 0, PCI_HEADER) >> 16;
+        if (!(header & 0x80)) {
+            continue;
+        }
+        for (unsigned int fn = 1; fn < 8; fn++) {
+            id = config_read(bus, dev, fn, PCI_ID);
+            if ((id & 0xFFFF) != 0xFFFF) {
+                add_function(bus, dev, fn, id);
+            }
+        }
+    }
+}
+
+void pci_init(void) {
+    device_count = 0;
+    scan_bus(0);
+}
+
+int pci_device_count(void) {
+    return device_count;
+}
+
+pci_device *pci_get(int index) {
+    return index >= 0 && index < device_count ? &devices[index] : 0;
+}
+
+pci_device *pci_find(unsigned short vendor, unsigned short device) {
+    for (int i = 0; i < device_count; i++) {
+        if (devices[i].vendor == vendor && devices[i].device == device) {
+            return &devices[i];
+        }
+    }
+    return 0;
+}
+
+pci_device *pci_find_class(unsigned char class_code, unsigned char subclass) {
+    for (int i = 0; i < device_count; i++) {
+        if (devices[i].class_code == class_code && devices[i].subclass == subclass) {
+            return &devices[i];
+        }
+    }
+    return 0;
+}
+
+unsigned int pci_bar_io(const pci_device *d, int bar) {
+    return d->bar[bar] & 1 ? d->bar[bar] & ~0x3 : 0;
+}
+
+unsigned int pci_bar_mem(const pci_device *d, int bar) {
+    return d->bar[bar] & 1 ? 0 : d->bar[bar] & ~0xF;
+}
+
+void pci_enable(const pci_device *d, unsigned int command_bits) {
+    unsigned int command = pci_read32(d, PCI_COMMAND) & 0xFFFF;
+    pci_write32(d, PCI_COMMAND, command | command_bits);
+}
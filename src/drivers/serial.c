@@ -0,0 +1,182 @@
+// serial.c
+#include "serial.h"
+#include "idt.h"
+#include "klib.h"
+#include "keyboard.h"
+#include "spinlock.h"
+
+// Register offsets from COM1_PORT
+#define UART_DATA 0         // RBR/THR, divisor low with DLAB
+#define UART_IER 1          // Divisor high with DLAB
+#define UART_IIR 2          // FCR on write
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+#define UART_SCRATCH 7
+
+#define IER_RX 0x01
+#define IER_TX 0x02
+#define IIR_NONE 0x01       // No interrupt pending
+#define IIR_FIFO 0xC0       // FIFO enabled and working (16550A)
+#define FCR_ENABLE 0xC7     // Enable, clear both FIFOs, 14-byte RX trigger
+#define LCR_DLAB 0x80
+#define LCR_8N1 0x03
+#define MCR_DTR_RTS_OUT2 0x0B   // OUT2 gates the IRQ line
+#define LSR_DATA_READY 0x01
+#define LSR_THR_EMPTY 0x20
+
+#define UART_CLOCK 115200
+#define UART_FIFO_DEPTH 16
+#define ASCII_ESC 0x1B
+
+static int present = 0;
+static unsigned int fifo_depth = 1;
+static spinlock tx_lock = SPINLOCK_INIT;
+
+// Producers advance tx_head, the FIFO refill advances tx_tail; both under
+// tx_lock since writers run on every CPU
+static char tx_ring[SERIAL_TX_SIZE];
+static unsigned int tx_head = 0;
+static unsigned int tx_tail = 0;
+static unsigned char ier = 0;
+
+// Escape sequence state for arrow keys (ESC [ A..D)
+static int rx_escape = 0;
+static int rx_last_cr = 0;
+
+static inline unsigned char uart_read(int reg) {
+    return inb(COM1_PORT + reg);
+}
+
+static inline void uart_write(int reg, unsigned char value) {
+    outb(COM1_PORT + reg, value);
+}
+
+// Caller holds tx_lock. Tops up the FIFO if it has drained, and keeps the
+// transmit interrupt enabled only while the ring has something left.
+static void tx_fill_locked(void) {
+    if (uart_read(UART_LSR) & LSR_THR_EMPTY) {
+        for (unsigned int n = 0; n < fifo_depth && tx_tail != tx_head; n++) {
+            uart_write(UART_DATA, tx_ring[tx_tail++ & (SERIAL_TX_SIZE - 1)]);
+        }
+    }
+    unsigned char want = tx_tail != tx_head ? IER_RX | IER_TX : IER_RX;
+    if (want != ier) {
+        ier = want;
+        uart_write(UART_IER, ier);
+    }
+}
+
+// Caller holds tx_lock; spins until the FIFO has taken more of the ring
+static void tx_wait_locked(void) {
+    while (!(uart_read(UART_LSR) & LSR_THR_EMPTY)) {
+        asm volatile ("pause");
+    }
+    tx_fill_locked();
+}
+
+static void tx_push_locked(char c) {
+    if (tx_head - tx_tail == SERIAL_TX_SIZE) {
+        tx_wait_locked(); // Ring full: fall back to polling for a while
+    }
+    tx_ring[tx_head++ & (SERIAL_TX_SIZE - 1)] = c;
+}
+
+static void rx_byte(unsigned char c) {
+    if (rx_escape == 1) {
+        rx_escape = c == '[' ? 2 : 0;
+        if (rx_escape == 0) {
+            keyboard_inject_char(SERIAL_CONSOLE, ASCII_ESC);
+            keyboard_inject_char(SERIAL_CONSOLE, c);
+        }
+        return;
+    }
+    if (rx_escape == 2) {
+        rx_escape = 0;
+        keyboard_inject_arrow(SERIAL_CONSOLE, c);
+        return;
+    }
+    if (c == ASCII_ESC) {
+        rx_escape = 1;
+        return;
+    }
+
+    // Terminals end lines with \r, \n or both; each is one Enter
+    if (c == '\n' && rx_last_cr) {
+        rx_last_cr = 0;
+        return;
+    }
+    rx_last_cr = c == '\r';
+    keyboard_inject_char(SERIAL_CONSOLE, c == '\r' ? '\n' : c);
+}
+
+static void serial_irq(interrupt_frame *frame) {
+    (void)frame;
+    while (!(uart_read(UART_IIR) & IIR_NONE)) {
+        while (uart_read(UART_LSR) & LSR_DATA_READY) {
+            rx_byte(uart_read(UART_DATA));
+        }
+        spin_lock(&tx_lock);
+        tx_fill_locked();
+        spin_unlock(&tx_lock);
+    }
+}
+
+int serial_init(void) {
+    // A missing UART reads back as all ones and has no scratch register
+    uart_write(UART_SCRATCH, 0x5A);
+    if (uart_read(UART_SCRATCH) != 0x5A || uart_read(UART_LSR) == 0xFF) {
+        return -1;
+    }
+
+    unsigned int divisor = UART_CLOCK / SERIAL_BAUD;
+    uart_write(UART_IER, 0);
+    uart_write(UART_LCR, LCR_DLAB);
+    uart_write(UART_DATA, divisor & 0xFF);
+    uart_write(UART_IER, divisor >> 8);
+    uart_write(UART_LCR, LCR_8N1);
+    uart_write(UART_IIR, FCR_ENABLE);
+    uart_write(UART_MCR, MCR_DTR_RTS_OUT2);
+
+    // Older 8250/16450 parts have a single-byte holding register
+    fifo_depth = (uart_read(UART_IIR) & IIR_FIFO) == IIR_FIFO ? UART_FIFO_DEPTH : 1;
+
+    while (uart_read(UART_LSR) & LSR_DATA_READY) {
+        uart_read(UART_DATA);
+    }
+    ier = IER_RX;
+    uart_write(UART_IER, ier);
+    irq_register(IRQ_COM1, serial_irq);
+    present = 1;
+    return 0;
+}
+
+int serial_present(void) {
+    return present;
+}
+
+void serial_write(const char *buf, unsigned int len) {
+    if (!present) {
+        return;
+    }
+    unsigned int flags = spin_lock_irqsave(&tx_lock);
+    for (unsigned int i = 0; i < len; i++) {
+        if (buf[i] == '\n') {
+            tx_push_locked('\r');
+        }
+        tx_push_locked(buf[i]);
+    }
+    tx_fill_locked();
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+void serial_flush(void) {
+    if (!present) {
+        return;
+    }
+    unsigned int flags = spin_lock_irqsave(&tx_lock);
+    while (tx_tail != tx_head) {
+        tx_wait_locked();
+    }
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
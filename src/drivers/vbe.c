@@ -0,0 +1,221 @@
+// vbe.c
+#include "vbe.h"
+#include "klib.h"
+#include "paging.h"
+#include "heap.h"
+#include "pci.h"
+
+#define VBE_INDEX_PORT 0x1CE
+#define VBE_DATA_PORT 0x1CF
+
+#define VBE_INDEX_ID 0x0
+#define VBE_INDEX_XRES 0x1
+#define VBE_INDEX_YRES 0x2
+#define VBE_INDEX_BPP 0x3
+#define VBE_INDEX_ENABLE 0x4
+#define VBE_INDEX_VIRT_WIDTH 0x6
+#define VBE_INDEX_VIRT_HEIGHT 0x7
+#define VBE_INDEX_Y_OFFSET 0x9
+#define VBE_INDEX_VIDEO_MEMORY_64K 0xA
+
+#define VBE_ID_MIN 0xB0C2           // First version with 32 bpp support
+#define VBE_ID_MAX 0xB0CF
+#define VBE_ENABLED 0x01
+#define VBE_LFB_ENABLED 0x40
+
+// QEMU/Bochs standard VGA; BAR0 is the linear framebuffer
+#define BOCHS_VGA_VENDOR 0x1234
+#define BOCHS_VGA_DEVICE 0x1111
+#define VBE_DEFAULT_LFB 0xE0000000
+
+// Rendered glyphs, keyed by the whole text cell (character + attribute)
+#define GLYPH_CACHE_SLOTS 1024
+#define GLYPH_PIXELS (VBE_FONT_WIDTH * VBE_FONT_HEIGHT)
+#define CURSOR_FIRST_ROW 14         // Underline cursor, like text mode
+
+// Standard VGA 16-colour palette as 0xRRGGBB
+static const unsigned int palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+static unsigned char font[256 * VBE_FONT_HEIGHT];
+static unsigned int *framebuffer;
+static unsigned int pitch;          // In pixels
+static int pan_row = 0;             // Text row of VRAM shown at the top
+static int virt_rows = VBE_ROWS;    // Text rows of VRAM we can pan over
+
+static unsigned int *glyph_cache;   // GLYPH_CACHE_SLOTS tiles
+static unsigned int glyph_tags[GLYPH_CACHE_SLOTS];  // cell + 1, 0 = empty
+
+static void vbe_write(unsigned short index, unsigned short value) {
+    outw(VBE_INDEX_PORT, index);
+    outw(VBE_DATA_PORT, value);
+}
+
+static unsigned short vbe_read(unsigned short index) {
+    outw(VBE_INDEX_PORT, index);
+    return inw(VBE_DATA_PORT);
+}
+
+static void vga_reg_write(unsigned short port, unsigned char index,
+                          unsigned char value) {
+    outb(port, index);
+    outb(port + 1, value);
+}
+
+static unsigned char vga_reg_read(unsigned short port, unsigned char index) {
+    outb(port, index);
+    return inb(port + 1);
+}
+
+// The adapter's text font lives in plane 2 of VGA memory, 32 bytes per
+// glyph. Map that plane at 0xA0000 for a moment and copy it out, so the
+// framebuffer console shows exactly the glyphs text mode did.
+static void load_font(void) {
+    unsigned char seq_map = vga_reg_read(0x3C4, 0x02);
+    unsigned char seq_mode = vga_reg_read(0x3C4, 0x04);
+    unsigned char gc_read = vga_reg_read(0x3CE, 0x04);
+    unsigned char gc_mode = vga_reg_read(0x3CE, 0x05);
+    unsigned char gc_misc = vga_reg_read(0x3CE, 0x06);
+
+    vga_reg_write(0x3C4, 0x02, 0x04);   // Plane 2 only
+    vga_reg_write(0x3C4, 0x04, 0x06);   // Sequential addressing
+    vga_reg_write(0x3CE, 0x04, 0x02);   // Read plane 2
+    vga_reg_write(0x3CE, 0x05, 0x00);   // No odd/even
+    vga_reg_write(0x3CE, 0x06, 0x04);   // Map 0xA0000, 64 KB
+
+    const volatile unsigned char *plane = (const volatile unsigned char *)0xA0000;
+    for (int ch = 0; ch < 256; ch++) {
+        for (int row = 0; row < VBE_FONT_HEIGHT; row++) {
+            font[ch * VBE_FONT_HEIGHT + row] = plane[ch * 32 + row];
+        }
+    }
+
+    vga_reg_write(0x3C4, 0x02, seq_map);
+    vga_reg_write(0x3C4, 0x04, seq_mode);
+    vga_reg_write(0x3CE, 0x04, gc_read);
+    vga_reg_write(0x3CE, 0x05, gc_mode);
+    vga_reg_write(0x3CE, 0x06, gc_misc);
+}
+
+// BAR0 of the Bochs VGA PCI function
+static unsigned int find_lfb(void) {
+    pci_device *vga = pci_find(BOCHS_VGA_VENDOR, BOCHS_VGA_DEVICE);
+    unsigned int lfb = vga != 0 ? pci_bar_mem(vga, 0) : 0;
+    return lfb != 0 ? lfb : VBE_DEFAULT_LFB;
+}
+
+int vbe_init(void) {
+    unsigned short id = vbe_read(VBE_INDEX_ID);
+    if (id < VBE_ID_MIN || id > VBE_ID_MAX) {
+        return -1;
+    }
+
+    unsigned int screen_bytes = VBE_XRES * VBE_YRES * (VBE_BPP / 8);
+    unsigned int vram = (unsigned int)vbe_read(VBE_INDEX_VIDEO_MEMORY_64K) << 16;
+    if (vram < screen_bytes) {
+        vram = screen_bytes;    // Older versions don't report it
+    }
+    // Twice the screen height lets us pan for a whole screen of scrolling
+    virt_rows = vram >= 2 * screen_bytes ? 2 * VBE_ROWS : VBE_ROWS;
+
+    unsigned int lfb = find_lfb();
+    unsigned int lfb_bytes = virt_rows * VBE_FONT_HEIGHT * VBE_XRES * (VBE_BPP / 8);
+    glyph_cache = kmalloc(GLYPH_CACHE_SLOTS * GLYPH_PIXELS * sizeof(unsigned int));
+    if (glyph_cache == 0 || paging_map_mmio(lfb, lfb_bytes) != 0) {
+        kfree(glyph_cache);
+        return -1;
+    }
+
+    load_font();
+
+    vbe_write(VBE_INDEX_ENABLE, 0);
+    vbe_write(VBE_INDEX_XRES, VBE_XRES);
+    vbe_write(VBE_INDEX_YRES, VBE_YRES);
+    vbe_write(VBE_INDEX_BPP, VBE_BPP);
+    vbe_write(VBE_INDEX_VIRT_WIDTH, VBE_XRES);
+    vbe_write(VBE_INDEX_VIRT_HEIGHT, virt_rows * VBE_FONT_HEIGHT);
+    vbe_write(VBE_INDEX_Y_OFFSET, 0);
+    vbe_write(VBE_INDEX_ENABLE, VBE_ENABLED | VBE_LFB_ENABLED);
+
+    framebuffer = (unsigned int *)lfb;
+    pitch = VBE_XRES;
+    return 0;
+}
+
+// Tile for a text cell, rendering it on a miss. Direct mapped: a typical
+// screen uses a few dozen characters in two or three colours.
+static const unsigned int *glyph(unsigned short cell) {
+    unsigned int slot = (cell * 2654435761u) >> 22;     // 10-bit hash
+    unsigned int *tile = glyph_cache + slot * GLYPH_PIXELS;
+    if (glyph_tags[slot] == (unsigned int)cell + 1) {
+        return tile;
+    }
+
+    unsigned int fg = palette[(cell >> 8) & 0xF];
+    unsigned int bg = palette[(cell >> 12) & 0xF];
+    const unsigned char *bits = font + (cell & 0xFF) * VBE_FONT_HEIGHT;
+    for (int row = 0; row < VBE_FONT_HEIGHT; row++) {
+        for (int col = 0; col < VBE_FONT_WIDTH; col++) {
+            tile[row * VBE_FONT_WIDTH + col] = bits[row] & (0x80 >> col) ? fg : bg;
+        }
+    }
+    glyph_tags[slot] = (unsigned int)cell + 1;
+    return tile;
+}
+
+static unsigned int *cell_address(int x, int y) {
+    int vram_row = (pan_row + y) * VBE_FONT_HEIGHT;
+    return framebuffer + vram_row * pitch + x * VBE_FONT_WIDTH;
+}
+
+// One glyph row is 8 pixels: eight 32-bit stores, no read-back
+static inline void blit_row(unsigned int *dst, const unsigned int *src) {
+    dst[0] = src[0];
+    dst[1] = src[1];
+    dst[2] = src[2];
+    dst[3] = src[3];
+    dst[4] = src[4];
+    dst[5] = src[5];
+    dst[6] = src[6];
+    dst[7] = src[7];
+}
+
+void vbe_draw(int y, int x0, int x1, const unsigned short *cells) {
+    unsigned int *line = cell_address(x0, y);
+    for (int row = 0; row < VBE_FONT_HEIGHT; row++) {
+        unsigned int *dst = line + row * pitch;
+        for (int x = x0; x < x1; x++) {
+            blit_row(dst, glyph(cells[x]) + row * VBE_FONT_WIDTH);
+            dst += VBE_FONT_WIDTH;
+        }
+    }
+}
+
+void vbe_draw_cursor(int x, int y, unsigned short cell) {
+    unsigned int *dst = cell_address(x, y);
+    const unsigned int *tile = glyph(cell);
+    for (int row = 0; row < CURSOR_FIRST_ROW; row++) {
+        blit_row(dst, tile + row * VBE_FONT_WIDTH);
+        dst += pitch;
+    }
+    unsigned int fg = palette[(cell >> 8) & 0xF];
+    for (int row = CURSOR_FIRST_ROW; row < VBE_FONT_HEIGHT; row++) {
+        for (int col = 0; col < VBE_FONT_WIDTH; col++) {
+            dst[col] = fg;
+        }
+        dst += pitch;
+    }
+}
+
+int vbe_scroll(int rows) {
+    if (pan_row + rows + VBE_ROWS > virt_rows) {
+        pan_row = 0;
+        vbe_write(VBE_INDEX_Y_OFFSET, 0);
+        return -1;
+    }
+    pan_row += rows;
+    vbe_write(VBE_INDEX_Y_OFFSET, pan_row * VBE_FONT_HEIGHT);
+    return 0;
+}
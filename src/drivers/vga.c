@@ -1,57 +1,513 @@
 // vga.c
 #include "vga.h"
+#include "vbe.h"
+#include "spinlock.h"
+#include "kmem.h"
+#include "timer.h"
+#include "heap.h"
+#include "pmm.h"
+#include "klib.h"
+#include "sched.h"
+
+#define VGA_BLANK ((VGA_DEFAULT_ATTR << 8) | ' ')
+#define VGA_TAB_WIDTH 8
+
+// CRTC index/data ports and the cursor location registers
+#define CRTC_INDEX 0x3D4
+#define CRTC_DATA 0x3D5
+#define CRTC_CURSOR_HIGH 0x0E
+#define CRTC_CURSOR_LOW 0x0F
+
+// A virtual console. Its text lives in a circular store of lines: the
+// live screen is the VGA_HEIGHT lines starting at ring index top, so
+// scrolling only advances top and blanks the line that comes into view,
+// and whatever scrolled off stays behind it as history.
+typedef struct {
+    unsigned short *lines;
+    unsigned int line_count;
+    unsigned int top;
+    unsigned int history;     // Valid lines above top
+    unsigned int view_back;   // Lines scrolled back, 0 = live
+    int x, y;                 // Cursor on the live screen
+    int width;                // Cells per stored line
+} vconsole;
 
 unsigned short *vga_buffer = (unsigned short *)VGA_BUFFER;
-int vga_x = 0, vga_y = 0;
+int vga_cols = VGA_TEXT_WIDTH;
+int vga_rows = VGA_TEXT_HEIGHT;
+static int framebuffer = 0;   // Drawing through vbe.c instead of text mode
+static spinlock console_lock = SPINLOCK_INIT;
+
+// Console 0 starts on a small static ring; vga_init gives every console
+// a store sized from free memory
+static unsigned short boot_lines[VGA_TEXT_HEIGHT * 2 * VGA_TEXT_WIDTH];
+static vconsole consoles[VGA_CONSOLES] = {
+    {boot_lines, VGA_TEXT_HEIGHT * 2, 0, 0, 0, 0, 0, VGA_TEXT_WIDTH},
+};
+static vconsole *active = &consoles[0];
+
+// Text-mode memory is uncached MMIO and very slow to read back in a VM,
+// so it is only ever written, one dirty span per screen row, on flush.
+// Only the active console is tracked; the others never touch hardware.
+// Live scrolls are counted rather than turned into a full redraw, so the
+// framebuffer can pan instead of redrawing every glyph.
+static unsigned char dirty_lo[VGA_MAX_HEIGHT];   // First dirty column
+static unsigned char dirty_hi[VGA_MAX_HEIGHT];   // One past the last, 0 if clean
+static volatile int dirty = 0;
+static int full_redraw = 0;
+static int pending_scroll = 0;               // Live scrolls since the last flush
+static unsigned int cursor_pos = 0xFFFF;     // Last value sent to the CRTC
+static int fb_cursor_x = -1, fb_cursor_y;    // Software cursor drawn on screen
+static ktimer flush_timer;
+static vga_mirror mirrors[VGA_CONSOLES];
+#define ANSI_CLEAR "\033[2J\033[H"
+
+// Console the calling thread prints to and reads from
+static vconsole *current_console(void) {
+    thread *t = thread_current();
+    return t != 0 && consoles[t->console].lines != 0 ? &consoles[t->console]
+                                                      : &consoles[0];
+}
+
+static unsigned short *ring_line(vconsole *con, unsigned int index) {
+    return con->lines + (index % con->line_count) * con->width;
+}
+
+// Line shown on screen row y, taking the scrollback position into account
+static unsigned short *screen_line(vconsole *con, int y) {
+    return ring_line(con, con->top + con->line_count + y - con->view_back);
+}
+
+// Caller holds console_lock; y is a screen row of the active console
+static void mark_dirty(int y, int x0, int x1) {
+    if (dirty_hi[y] == 0) {
+        dirty_lo[y] = x0;
+        dirty_hi[y] = x1;
+    } else {
+        if (x0 < dirty_lo[y]) dirty_lo[y] = x0;
+        if (x1 > dirty_hi[y]) dirty_hi[y] = x1;
+    }
+    dirty = 1;
+}
+
+static void mark_all_dirty(vconsole *con) {
+    if (con != active) {
+        return;
+    }
+    full_redraw = 1;
+    dirty = 1;
+}
+
+// The active console's live screen moved up one line: what was dirty
+// moves with it, and the new bottom line has to be drawn
+static void mark_scrolled(void) {
+    kmemmove(dirty_lo, dirty_lo + 1, VGA_HEIGHT - 1);
+    kmemmove(dirty_hi, dirty_hi + 1, VGA_HEIGHT - 1);
+    dirty_hi[VGA_HEIGHT - 1] = 0;
+    mark_dirty(VGA_HEIGHT - 1, 0, VGA_WIDTH);
+    pending_scroll++;
+}
+
+// A write to live row y only shows if that row is inside the view
+static void mark_live_dirty(vconsole *con, int y, int x0, int x1) {
+    if (con == active && y + (int)con->view_back < VGA_HEIGHT) {
+        mark_dirty(y + con->view_back, x0, x1);
+    }
+}
+
+// Copy dirty spans to MMIO. Spans that continue across a row boundary in
+// both the screen and the line store go out as a single copy, so a whole
+// screen (after a scroll or console switch) is one bulk copy unless it
+// wraps around the end of the ring.
+static void flush_text(void) {
+    unsigned short *dst = 0, *src = 0;
+    unsigned int len = 0;   // Pending run, in cells
+
+    for (int y = 0; y < VGA_HEIGHT; y++) {
+        if (dirty_hi[y] == 0) {
+            continue;
+        }
+        unsigned short *d = vga_buffer + y * VGA_WIDTH + dirty_lo[y];
+        unsigned short *s = screen_line(active, y) + dirty_lo[y];
+        if (d != dst + len || s != src + len) {
+            if (len > 0) {
+                kmemcpy(dst, src, len * sizeof(unsigned short));
+            }
+            dst = d;
+            src = s;
+            len = 0;
+        }
+        len += dirty_hi[y] - dirty_lo[y];
+        dirty_hi[y] = 0;
+    }
+    if (len > 0) {
+        kmemcpy(dst, src, len * sizeof(unsigned short));
+    }
+
+    // The cursor follows the live screen; while history is shown and the
+    // cursor row is out of view, park it past the last cell to hide it
+    unsigned int row = active->y + active->view_back;
+    unsigned int pos = row < (unsigned int)VGA_HEIGHT
+                     ? row * VGA_WIDTH + active->x
+                     : (unsigned int)(VGA_WIDTH * VGA_HEIGHT);
+    if (pos != cursor_pos) {
+        outb(CRTC_INDEX, CRTC_CURSOR_LOW);
+        outb(CRTC_DATA, pos & 0xFF);
+        outb(CRTC_INDEX, CRTC_CURSOR_HIGH);
+        outb(CRTC_DATA, pos >> 8);
+        cursor_pos = pos;
+    }
+}
+
+// Scrolls pan the framebuffer, so only the lines that came into view and
+// the dirty spans are drawn. The cursor is drawn in software: the cell it
+// was on is redrawn plain before it is drawn at its new place.
+static void flush_fb(void) {
+    if (pending_scroll > 0 && !full_redraw) {
+        if (pending_scroll >= VGA_HEIGHT || vbe_scroll(pending_scroll) != 0) {
+            full_redraw = 1;
+        } else if (fb_cursor_x >= 0) {
+            fb_cursor_y -= pending_scroll;
+        }
+    }
+    if (full_redraw) {
+        for (int y = 0; y < VGA_HEIGHT; y++) {
+            dirty_lo[y] = 0;
+            dirty_hi[y] = VGA_WIDTH;
+        }
+        fb_cursor_x = -1;
+    }
+
+    for (int y = 0; y < VGA_HEIGHT; y++) {
+        if (dirty_hi[y] != 0) {
+            vbe_draw(y, dirty_lo[y], dirty_hi[y], screen_line(active, y));
+            dirty_hi[y] = 0;
+        }
+    }
+
+    int row = active->y + active->view_back;
+    if (fb_cursor_x >= 0 && fb_cursor_y >= 0 &&
+        (fb_cursor_x != active->x || fb_cursor_y != row)) {
+        vbe_draw(fb_cursor_y, fb_cursor_x, fb_cursor_x + 1,
+                 screen_line(active, fb_cursor_y));
+    }
+    fb_cursor_x = -1;
+    if (row < VGA_HEIGHT && active->x < VGA_WIDTH) {
+        vbe_draw_cursor(active->x, row, screen_line(active, row)[active->x]);
+        fb_cursor_x = active->x;
+        fb_cursor_y = row;
+    }
+}
+
+static void flush_locked(void) {
+    if (framebuffer) {
+        flush_fb();
+    } else {
+        if (full_redraw || pending_scroll > 0) {
+            for (int y = 0; y < VGA_HEIGHT; y++) {
+                dirty_lo[y] = 0;
+                dirty_hi[y] = VGA_WIDTH;
+            }
+        }
+        flush_text();
+    }
+    full_redraw = 0;
+    pending_scroll = 0;
+    dirty = 0;
+}
+
+void vga_flush(void) {
+    if (!dirty) {
+        return;
+    }
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    flush_locked();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Periodic flush, so output from long-running commands still shows up
+static void flush_tick(void *arg) {
+    (void)arg;
+    vga_flush();
+}
+
+// Switch to the framebuffer if there is one, then give every console a
+// line store sized from free memory; console 0 keeps what was printed
+// into its boot ring
+void vga_init(void) {
+    int cols = VGA_TEXT_WIDTH, rows = VGA_TEXT_HEIGHT;
+    if (vbe_init() == 0) {
+        framebuffer = 1;
+        cols = VBE_COLS;
+        rows = VBE_ROWS;
+    }
+
+    unsigned int line_bytes = cols * sizeof(unsigned short);
+    unsigned int want = pmm_free_count() / VGA_SCROLLBACK_SHARE *
+                        PAGE_SIZE / line_bytes / VGA_CONSOLES;
+    if (want < VGA_SCROLLBACK_MIN) want = VGA_SCROLLBACK_MIN;
+    if (want > VGA_SCROLLBACK_MAX) want = VGA_SCROLLBACK_MAX;
+
+    for (int i = 0; i < VGA_CONSOLES; i++) {
+        vconsole *con = &consoles[i];
+        unsigned int count = want;
+        unsigned short *store = 0;
+        while (count >= (unsigned int)rows * 2 &&
+               (store = kmalloc(count * line_bytes)) == 0) {
+            count /= 2;
+        }
+        if (store == 0) {
+            if (i == 0) {
+                // Console 0 keeps its boot ring, so the grid stays 80x25
+                cols = VGA_TEXT_WIDTH;
+                rows = VGA_TEXT_HEIGHT;
+                line_bytes = cols * sizeof(unsigned short);
+            }
+            continue; // Other consoles stay unused
+        }
+
+        unsigned int flags = spin_lock_irqsave(&console_lock);
+        if (con->lines == 0) {
+            kmemsetw(store, VGA_BLANK, rows * cols);
+            con->line_count = count;
+            con->width = cols;
+        } else {
+            // Re-lay the boot text out at the new width, keeping the cursor
+            // on the same line and as much of the old screen as fits
+            unsigned int kept = con->history + VGA_HEIGHT;
+            int copy = con->width < cols ? con->width : cols;
+            for (unsigned int n = 0; n < kept; n++) {
+                unsigned short *line = store + n * cols;
+                kmemcpy(line, ring_line(con, con->top + con->line_count - con->history + n),
+                        copy * sizeof(unsigned short));
+                kmemsetw(line + copy, VGA_BLANK, cols - copy);
+            }
+            unsigned int top = kept > (unsigned int)rows ? kept - rows : 0;
+            for (unsigned int n = kept; n < top + rows; n++) {
+                kmemsetw(store + n * cols, VGA_BLANK, cols);
+            }
+            con->y += con->history - top;
+            con->line_count = count;
+            con->top = top;
+            con->history = top;
+            con->width = cols;
+            vga_cols = cols;
+            vga_rows = rows;
+        }
+        con->lines = store;
+        spin_unlock_irqrestore(&console_lock, flags);
+    }
+
+    // A fresh framebuffer is blank, and text mode may have a new layout
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    mark_all_dirty(active);
+    flush_locked();
+    spin_unlock_irqrestore(&console_lock, flags);
+
+    timer_start(&flush_timer, VGA_FLUSH_MS, VGA_FLUSH_MS, flush_tick, 0);
+}
 
+// Clears the live screen; history is left as it was
 void vga_clear() {
-    for (int i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++)
-        vga_buffer[i] = (0x07 << 8) | ' '; // White on black
-    vga_x = 0;
-    vga_y = 0;
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    vconsole *con = current_console();
+    vga_mirror mirror = mirrors[con - consoles];
+    for (int y = 0; y < VGA_HEIGHT; y++) {
+        kmemsetw(ring_line(con, con->top + y), VGA_BLANK, con->width);
+    }
+    con->view_back = 0;
+    con->x = 0;
+    con->y = 0;
+    mark_all_dirty(con);
+    spin_unlock_irqrestore(&console_lock, flags);
+    if (mirror != 0) {
+        mirror(ANSI_CLEAR, sizeof(ANSI_CLEAR) - 1);
+    }
 }
 
-void vga_putc(char c) {
+// Bring a new blank line in at the bottom: O(1) in the screen size
+static void scroll_locked(vconsole *con) {
+    con->top = (con->top + 1) % con->line_count;
+    kmemsetw(ring_line(con, con->top + VGA_HEIGHT - 1), VGA_BLANK, con->width);
+    if (con->history < con->line_count - VGA_HEIGHT) {
+        con->history++;
+    }
+
+    // Someone reading history keeps the same text in view, until it
+    // falls off the end of the store
+    if (con->view_back > 0 && con->view_back < con->history) {
+        con->view_back++;
+    } else if (con->view_back == 0 && con == active) {
+        mark_scrolled();
+    } else {
+        mark_all_dirty(con);
+    }
+}
+
+// Move to the start of the next line, scrolling at the bottom
+static void newline_locked(vconsole *con) {
+    con->x = 0;
+    con->y++;
+    if (con->y >= VGA_HEIGHT) {
+        scroll_locked(con);
+        con->y = VGA_HEIGHT - 1;
+    }
+}
+
+// Caller holds console_lock
+static void control_locked(vconsole *con, char c, unsigned short blank) {
+    unsigned short *line = ring_line(con, con->top + con->y);
+
     if (c == '\n') {
-        vga_x = 0;
-        vga_y++;
+        newline_locked(con);
+    } else if (c == '\r') {
+        con->x = 0;
     } else if (c == '\b') {
-        if (vga_x > 0) {
-            vga_x--;
-        } else if (vga_y > 0) {
-            vga_y--;
-            vga_x = VGA_WIDTH - 1;
+        if (con->x > 0) {
+            con->x--;
+        } else if (con->y > 0) {
+            con->y--;
+            con->x = VGA_WIDTH - 1;
+            line = ring_line(con, con->top + con->y);
+        }
+        line[con->x] = blank;
+        mark_live_dirty(con, con->y, con->x, con->x + 1);
+    } else if (c == '\t') {
+        int next = (con->x / VGA_TAB_WIDTH + 1) * VGA_TAB_WIDTH;
+        if (next > VGA_WIDTH) next = VGA_WIDTH;
+        kmemsetw(line + con->x, blank, next - con->x);
+        mark_live_dirty(con, con->y, con->x, next);
+        con->x = next;
+        if (con->x >= VGA_WIDTH) {
+            newline_locked(con);
         }
-        vga_buffer[vga_y * VGA_WIDTH + vga_x] = (0x07 << 8) | ' ';
     } else {
-        vga_buffer[vga_y * VGA_WIDTH + vga_x] = (0x07 << 8) | c;
-        vga_x++;
-    }
-    
-    if (vga_x >= VGA_WIDTH) {
-        vga_x = 0;
-        vga_y++;
+        // Other control bytes show as their code page 437 glyphs
+        line[con->x] = (blank & 0xFF00) | (unsigned char)c;
+        mark_live_dirty(con, con->y, con->x, con->x + 1);
+        if (++con->x >= VGA_WIDTH) {
+            newline_locked(con);
+        }
     }
-    
-    if (vga_y >= VGA_HEIGHT) {
-        // Scroll the screen
-        for (int i = 0; i < (VGA_HEIGHT - 1) * VGA_WIDTH; i++) {
-            vga_buffer[i] = vga_buffer[i + VGA_WIDTH];
+}
+
+// Caller holds console_lock. Printable runs are copied in one go, up to
+// the end of the line, and dirty-marked once per run.
+static void write_locked(vconsole *con, const char *buf, unsigned int len,
+                         unsigned char attr) {
+    unsigned short cell_attr = attr << 8;
+
+    while (len > 0) {
+        unsigned int room = VGA_WIDTH - con->x;
+        unsigned int run = 0;
+        while (run < len && run < room && (unsigned char)buf[run] >= ' ') {
+            run++;
+        }
+
+        if (run == 0) {
+            control_locked(con, *buf++, cell_attr | ' ');
+            len--;
+            continue;
         }
-        // Clear the last line
-        for (int i = (VGA_HEIGHT - 1) * VGA_WIDTH; i < VGA_HEIGHT * VGA_WIDTH; i++) {
-            vga_buffer[i] = (0x07 << 8) | ' ';
+
+        unsigned short *cell = ring_line(con, con->top + con->y) + con->x;
+        for (unsigned int i = 0; i < run; i++) {
+            cell[i] = cell_attr | (unsigned char)buf[i];
+        }
+        mark_live_dirty(con, con->y, con->x, con->x + run);
+        con->x += run;
+        buf += run;
+        len -= run;
+        if (con->x >= VGA_WIDTH) {
+            newline_locked(con);
         }
-        vga_y = VGA_HEIGHT - 1;
     }
+    if (con == active) {
+        dirty = 1; // The cursor moved even if no cell changed
+    }
+}
+
+void vga_write_attr(const char *buf, unsigned int len, unsigned char attr) {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    vconsole *con = current_console();
+    vga_mirror mirror = mirrors[con - consoles];
+    write_locked(con, buf, len, attr);
+    spin_unlock_irqrestore(&console_lock, flags);
+    if (mirror != 0) {
+        mirror(buf, len);
+    }
+}
+
+void vga_write(const char *buf, unsigned int len) {
+    vga_write_attr(buf, len, VGA_DEFAULT_ATTR);
+}
+
+void vga_putc(char c) {
+    vga_write_attr(&c, 1, VGA_DEFAULT_ATTR);
 }
 
 void vga_putc_at(int x, int y, char c) {
     if (x >= 0 && x < VGA_WIDTH && y >= 0 && y < VGA_HEIGHT) {
-        vga_buffer[y * VGA_WIDTH + x] = (0x07 << 8) | c;
+        unsigned int flags = spin_lock_irqsave(&console_lock);
+        vconsole *con = current_console();
+        ring_line(con, con->top + y)[x] = (VGA_DEFAULT_ATTR << 8) | (unsigned char)c;
+        mark_live_dirty(con, y, x, x + 1);
+        spin_unlock_irqrestore(&console_lock, flags);
     }
 }
 
+// One locked write for the whole string, so other CPUs can't split it
 void vga_puts(const char *s) {
-    while (*s) vga_putc(*s++);
-}
\ No newline at end of file
+    unsigned int len = 0;
+    while (s[len]) len++;
+    vga_write_attr(s, len, VGA_DEFAULT_ATTR);
+}
+
+// Move the active console's view lines further back into history
+// (negative: towards the live screen), clamped to what the store holds
+void vga_scroll_view(int delta) {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    int target = (int)active->view_back + delta;
+    if (target < 0) target = 0;
+    if (target > (int)active->history) target = active->history;
+    if ((unsigned int)target != active->view_back) {
+        active->view_back = target;
+        mark_all_dirty(active);
+    }
+    spin_unlock_irqrestore(&console_lock, flags);
+    vga_flush();
+}
+
+void vga_scroll_live(void) {
+    if (active->view_back != 0) {
+        vga_scroll_view(-(int)active->view_back);
+    }
+}
+
+void vga_mirror_attach(int console, vga_mirror mirror) {
+    if (console >= 0 && console < VGA_CONSOLES) {
+        mirrors[console] = mirror;
+    }
+}
+
+// Show another console: its whole screen goes out in one flush
+void vga_console_switch(int index) {
+    if (index < 0 || index >= VGA_CONSOLES || consoles[index].lines == 0) {
+        return;
+    }
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    if (active != &consoles[index]) {
+        active = &consoles[index];
+        mark_all_dirty(active);
+        flush_locked();
+    }
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+int vga_console_active(void) {
+    return active - consoles;
+}
+
+int vga_console_current(void) {
+    return current_console() - consoles;
+}
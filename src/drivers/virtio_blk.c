@@ -0,0 +1,270 @@
+// virtio_blk.c
+#include "virtio_blk.h"
+#include "blkdev.h"
+#include "klib.h"
+#include "kprintf.h"
+#include "heap.h"
+#include "paging.h"
+#include "pmm.h"
+#include "pci.h"
+#include "idt.h"
+#include "spinlock.h"
+
+#define VIRTIO_VENDOR 0x1AF4
+#define VIRTIO_BLK_DEVICE 0x1001    // Transitional device, legacy interface
+
+// Legacy register offsets from BAR0
+#define VIRTIO_DEVICE_FEATURES 0x00
+#define VIRTIO_GUEST_FEATURES 0x04
+#define VIRTIO_QUEUE_PFN 0x08
+#define VIRTIO_QUEUE_SIZE 0x0C
+#define VIRTIO_QUEUE_SELECT 0x0E
+#define VIRTIO_QUEUE_NOTIFY 0x10
+#define VIRTIO_STATUS 0x12
+#define VIRTIO_ISR 0x13
+#define VIRTIO_BLK_CAPACITY 0x14    // Sectors, 64 bits
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+#define VIRTIO_ISR_QUEUE 0x01
+
+#define VRING_DESC_F_NEXT 0x01
+#define VRING_DESC_F_WRITE 0x02     // Device writes this buffer
+#define VRING_USED_F_NO_NOTIFY 0x01
+#define VRING_ALIGN PAGE_SIZE       // The legacy interface fixes this
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_S_OK 0
+
+#define DESCS_PER_REQUEST 3         // Header, data, status
+#define MAX_SLOTS (PAGE_SIZE / sizeof(request_slot))
+#define NO_SLOT 0xFFFF
+
+typedef struct {
+    unsigned long long addr;
+    unsigned int len;
+    unsigned short flags;
+    unsigned short next;
+} __attribute__((packed)) vring_desc;
+
+typedef struct {
+    unsigned short flags;
+    unsigned short idx;
+    unsigned short ring[];
+} __attribute__((packed)) vring_avail;
+
+typedef struct {
+    unsigned int id;
+    unsigned int len;
+} __attribute__((packed)) vring_used_elem;
+
+typedef struct {
+    unsigned short flags;
+    unsigned short idx;
+    vring_used_elem ring[];
+} __attribute__((packed)) vring_used;
+
+typedef struct {
+    unsigned int type;
+    unsigned int reserved;
+    unsigned long long sector;
+} __attribute__((packed)) virtio_blk_header;
+
+// Each slot owns a fixed chain of three descriptors, so the free list is
+// kept per request rather than per descriptor
+typedef struct {
+    virtio_blk_header header;
+    blk_request *req;
+    unsigned short next_free;
+    volatile unsigned char status;
+    unsigned char pad[9];
+} request_slot;
+
+_Static_assert(sizeof(request_slot) == 32, "request_slot size");
+
+static unsigned short io_base;
+static unsigned short queue_size;
+static vring_desc *desc;
+static vring_avail *avail;
+static volatile vring_used *used;
+static unsigned short last_used;    // Next used entry to reap
+static request_slot *slots;         // One page, so headers never cross it
+static unsigned short free_slot;
+static spinlock vblk_lock = SPINLOCK_INIT;
+static blkdev vblk_dev;
+
+static unsigned int align_up(unsigned int n, unsigned int align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+// Hand every finished request back; called with vblk_lock held
+static void reap(void) {
+    while (last_used != used->idx) {
+        asm volatile ("" ::: "memory"); // Entry after idx
+        unsigned int id = used->ring[last_used & (queue_size - 1)].id;
+        unsigned short s = id / DESCS_PER_REQUEST;
+        blk_request *req = slots[s].req;
+        int status = slots[s].status == VIRTIO_BLK_S_OK ? 0 : -1;
+        slots[s].req = 0;
+        slots[s].next_free = free_slot;
+        free_slot = s;
+        last_used++;
+        blkdev_complete(&vblk_dev, req, status);
+    }
+}
+
+// Publish what has been added to the ring and tell the device, unless it
+// has said it is still working through the ring and will find it anyway
+static void kick(unsigned short added) {
+    asm volatile ("" ::: "memory");     // Ring entries before idx
+    avail->idx += added;
+    __sync_synchronize();               // idx before reading used->flags
+    if (!(used->flags & VRING_USED_F_NO_NOTIFY)) {
+        outw(io_base + VIRTIO_QUEUE_NOTIFY, 0);
+    }
+}
+
+static int vblk_submit(blkdev *dev, blk_request *reqs, int count) {
+    (void)dev;
+    unsigned int flags = spin_lock_irqsave(&vblk_lock);
+    unsigned short added = 0;
+    for (int i = 0; i < count; i++) {
+        if (free_slot == NO_SLOT) {
+            // Ring full: send what we have and reap until a slot frees
+            kick(added);
+            added = 0;
+            while (free_slot == NO_SLOT) {
+                asm volatile ("pause");
+                reap();
+            }
+        }
+        unsigned short s = free_slot;
+        request_slot *slot = &slots[s];
+        free_slot = slot->next_free;
+
+        blk_request *req = &reqs[i];
+        slot->req = req;
+        slot->status = 0xFF;
+        slot->header.type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        slot->header.reserved = 0;
+        slot->header.sector = req->lba;
+
+        vring_desc *data = &desc[s * DESCS_PER_REQUEST + 1];
+        data->addr = virt_to_phys(req->buf);
+        data->len = req->count * BLK_SECTOR_SIZE;
+        data->flags = VRING_DESC_F_NEXT | (req->write ? 0 : VRING_DESC_F_WRITE);
+
+        avail->ring[(avail->idx + added) & (queue_size - 1)] = s * DESCS_PER_REQUEST;
+        added++;
+    }
+    kick(added);
+    spin_unlock_irqrestore(&vblk_lock, flags);
+    return 0;
+}
+
+static void vblk_poll(blkdev *dev) {
+    (void)dev;
+    unsigned int flags = spin_lock_irqsave(&vblk_lock);
+    reap();
+    spin_unlock_irqrestore(&vblk_lock, flags);
+}
+
+static void vblk_irq(interrupt_frame *frame) {
+    (void)frame;
+    // Reading the ISR acknowledges it; anything finishing after this
+    // raises the line again
+    if (inb(io_base + VIRTIO_ISR) & VIRTIO_ISR_QUEUE) {
+        spin_lock(&vblk_lock);
+        reap();
+        spin_unlock(&vblk_lock);
+    }
+}
+
+static int setup_queue(void) {
+    outw(io_base + VIRTIO_QUEUE_SELECT, 0);
+    queue_size = inw(io_base + VIRTIO_QUEUE_SIZE);
+    if (queue_size < DESCS_PER_REQUEST || (queue_size & (queue_size - 1)) != 0) {
+        return -1;
+    }
+    unsigned int avail_end = sizeof(vring_desc) * queue_size +
+                             sizeof(unsigned short) * (3 + queue_size);
+    unsigned int used_start = align_up(avail_end, VRING_ALIGN);
+    unsigned int bytes = used_start + align_up(sizeof(unsigned short) * 3 +
+                                               sizeof(vring_used_elem) * queue_size,
+                                               VRING_ALIGN);
+    // Whole pages from kmalloc are page aligned and physically contiguous
+    unsigned char *ring = kzalloc(bytes);
+    slots = kzalloc(PAGE_SIZE);
+    if (ring == 0 || slots == 0) {
+        kfree(ring);
+        kfree(slots);
+        return -1;
+    }
+    desc = (vring_desc *)ring;
+    avail = (vring_avail *)(ring + sizeof(vring_desc) * queue_size);
+    used = (volatile vring_used *)(ring + used_start);
+
+    unsigned int count = queue_size / DESCS_PER_REQUEST;
+    if (count > MAX_SLOTS) {
+        count = MAX_SLOTS;
+    }
+    free_slot = NO_SLOT;
+    for (unsigned int s = count; s-- > 0;) {
+        vring_desc *d = &desc[s * DESCS_PER_REQUEST];
+        d[0].addr = virt_to_phys(&slots[s].header);
+        d[0].len = sizeof(virtio_blk_header);
+        d[0].flags = VRING_DESC_F_NEXT;
+        d[0].next = s * DESCS_PER_REQUEST + 1;
+        d[1].next = s * DESCS_PER_REQUEST + 2;
+        d[2].addr = virt_to_phys((void *)&slots[s].status);
+        d[2].len = 1;
+        d[2].flags = VRING_DESC_F_WRITE;
+        slots[s].next_free = free_slot;
+        free_slot = s;
+    }
+    vblk_dev.max_batch = count;
+    outl(io_base + VIRTIO_QUEUE_PFN, virt_to_phys(ring) / PAGE_SIZE);
+    return 0;
+}
+
+int virtio_blk_init(void) {
+    pci_device *pci = pci_find(VIRTIO_VENDOR, VIRTIO_BLK_DEVICE);
+    if (pci == 0 || pci_bar_io(pci, 0) == 0) {
+        return -1;
+    }
+    if (pci->irq == 0 || pci->irq > 15) {
+        kprintf("virtio-blk: no interrupt line\n");
+        return -1;
+    }
+    io_base = pci_bar_io(pci, 0);
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    outb(io_base + VIRTIO_STATUS, 0); // Reset
+    outb(io_base + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io_base + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    inl(io_base + VIRTIO_DEVICE_FEATURES);
+    outl(io_base + VIRTIO_GUEST_FEATURES, 0); // Plain reads and writes will do
+    if (setup_queue() != 0) {
+        outb(io_base + VIRTIO_STATUS, VIRTIO_STATUS_FAILED);
+        kprintf("virtio-blk: cannot set up the queue\n");
+        return -1;
+    }
+
+    unsigned int low = inl(io_base + VIRTIO_BLK_CAPACITY);
+    unsigned int high = inl(io_base + VIRTIO_BLK_CAPACITY + 4);
+    vblk_dev.name = "vda";
+    vblk_dev.sectors = high != 0 ? 0xFFFFFFFF : low;
+    vblk_dev.submit = vblk_submit;
+    vblk_dev.poll = vblk_poll;
+    blkdev_register(&vblk_dev);
+
+    irq_register(pci->irq, vblk_irq);
+    outb(io_base + VIRTIO_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER |
+                                  VIRTIO_STATUS_DRIVER_OK);
+    kprintf("virtio-blk: %u sectors (%u MB), %u-request queue, IRQ %u\n",
+            vblk_dev.sectors, vblk_dev.sectors / 2048, vblk_dev.max_batch, pci->irq);
+    return 0;
+}
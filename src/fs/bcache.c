@@ -0,0 +1,431 @@
+// bcache.c
+#include "bcache.h"
+#include "heap.h"
+#include "pmm.h"
+#include "sched.h"
+#include "kprintf.h"
+#include <stddef.h>
+
+typedef struct {
+    blkdev *dev;                    // NULL while unused
+    unsigned int next;              // Block a sequential reader asks for next
+    unsigned int window;            // Blocks to read ahead of it
+} ra_stream;
+
+static bcache_buf *buffers;
+static unsigned int capacity;
+static bcache_buf **buckets;
+static unsigned int bucket_mask;
+static bcache_buf *lru_head;               // Most recently used
+static bcache_buf *lru_tail;               // First to be recycled
+static ra_stream streams[BCACHE_STREAMS];
+static unsigned int next_stream;
+static bcache_stats stats;
+
+// Its lock guards the whole cache; buffers wait on it for I/O to finish
+// or for one to become idle
+static wait_queue bcache_wq;
+
+static unsigned int cache_lock(void) {
+    return spin_lock_irqsave(&bcache_wq.lock);
+}
+
+static void cache_unlock(unsigned int flags) {
+    spin_unlock_irqrestore(&bcache_wq.lock, flags);
+}
+
+static void flusher(void *arg) {
+    (void)arg;
+    while (1) {
+        thread_sleep(BCACHE_FLUSH_MS);
+        bcache_sync();
+    }
+}
+
+void bcache_init(void) {
+    capacity = pmm_total_frames() * PAGE_SIZE / BCACHE_BLOCK_SIZE / BCACHE_RAM_FRACTION;
+    if (capacity < BCACHE_MIN_BUFFERS) {
+        capacity = BCACHE_MIN_BUFFERS;
+    }
+    unsigned int bucket_count = 1;
+    while (bucket_count < capacity) {
+        bucket_count <<= 1;
+    }
+    // Buffer memory itself is allocated as blocks first come in
+    buffers = kzalloc(capacity * sizeof(bcache_buf));
+    buckets = kzalloc(bucket_count * sizeof(bcache_buf *));
+    if (buffers == NULL || buckets == NULL) {
+        kfree(buffers);
+        kfree(buckets);
+        buffers = NULL;
+        capacity = 0;
+        kprintf("bcache: out of memory\n");
+    }
+    bucket_mask = bucket_count - 1;
+    wait_queue_init(&bcache_wq);
+    stats.buffers = capacity;
+    stats.readahead_limit = BCACHE_RA_MAX;
+    thread_create("bflush", flusher, NULL, PRIORITY_LOW);
+}
+
+static unsigned int bucket_of(blkdev *dev, unsigned int block) {
+    return (block * 2654435761u ^ ((unsigned int)dev >> 4)) & bucket_mask;
+}
+
+static bcache_buf *lookup(blkdev *dev, unsigned int block) {
+    for (bcache_buf *b = buckets[bucket_of(dev, block)]; b != NULL; b = b->hash_next) {
+        if (b->dev == dev && b->block == block) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+static void unhash(bcache_buf *b) {
+    if (b->dev == NULL) {
+        return;
+    }
+    *b->hash_pprev = b->hash_next;
+    if (b->hash_next) {
+        b->hash_next->hash_pprev = b->hash_pprev;
+    }
+    b->dev = NULL;
+}
+
+static void lru_unlink(bcache_buf *b) {
+    if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+    else lru_head = b->lru_next;
+    if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+    else lru_tail = b->lru_prev;
+}
+
+static void lru_push_head(bcache_buf *b) {
+    b->lru_prev = NULL;
+    b->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = b;
+    else lru_tail = b;
+    lru_head = b;
+}
+
+// A buffer that can take a new block: fresh memory while under capacity,
+// else the least recently used one nobody holds. Dirty ones are passed
+// over when clean_only is set. NULL if there is none.
+static bcache_buf *find_victim(int clean_only) {
+    if (stats.used < capacity) {
+        bcache_buf *b = &buffers[stats.used];
+        b->data = kmalloc(BCACHE_BLOCK_SIZE);
+        if (b->data != NULL) {
+            stats.used++;
+            lru_push_head(b);
+            return b;
+        }
+    }
+    for (bcache_buf *b = lru_tail; b != NULL; b = b->lru_prev) {
+        if (b->refs == 0 && !(b->flags & BUF_BUSY) &&
+            !(clean_only && (b->flags & BUF_DIRTY))) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+// Give an idle, clean buffer to dev:block, held once
+static void claim(bcache_buf *b, blkdev *dev, unsigned int block) {
+    if (b->dev != NULL) {
+        stats.evictions++;
+        if (b->flags & BUF_READAHEAD) {
+            // Read ahead for nothing: be less eager
+            stats.readahead_wasted++;
+            if (stats.readahead_limit / 2 >= BCACHE_RA_MIN) {
+                stats.readahead_limit /= 2;
+            }
+        }
+        unhash(b);
+    }
+    b->dev = dev;
+    b->block = block;
+    b->flags = 0;
+    b->refs = 1;
+    unsigned int i = bucket_of(dev, block);
+    b->hash_next = buckets[i];
+    b->hash_pprev = &buckets[i];
+    if (buckets[i]) {
+        buckets[i]->hash_pprev = &b->hash_next;
+    }
+    buckets[i] = b;
+    lru_unlink(b);
+    lru_push_head(b);
+}
+
+// Submit one batch to dev and wait for it; -1 if any request failed
+static int transfer(blkdev *dev, bcache_buf **list, blk_request *reqs, int count,
+                    int write) {
+    for (int i = 0; i < count; i++) {
+        reqs[i].lba = list[i]->block * BCACHE_SECTORS;
+        reqs[i].count = BCACHE_SECTORS;
+        reqs[i].buf = list[i]->data;
+        reqs[i].write = write;
+    }
+    if (blkdev_submit(dev, reqs, count) != 0) {
+        for (int i = 0; i < count; i++) {
+            reqs[i].status = -1;
+        }
+        return -1;
+    }
+    return blkdev_wait(dev, reqs, count);
+}
+
+// Dirty, idle-for-I/O buffers of one device, starting with first if given,
+// then from the cold end; sorted by block so the disk sees them in order
+static int collect_dirty(bcache_buf *first, bcache_buf **list) {
+    int count = 0;
+    blkdev *dev = NULL;
+    if (first != NULL) {
+        list[count++] = first;
+        dev = first->dev;
+    }
+    for (bcache_buf *b = lru_tail; b != NULL && count < BCACHE_BATCH; b = b->lru_prev) {
+        if (b == first || !(b->flags & BUF_DIRTY) || (b->flags & BUF_BUSY) ||
+            (dev != NULL && b->dev != dev)) {
+            continue;
+        }
+        dev = b->dev;
+        list[count++] = b;
+    }
+    for (int i = 1; i < count; i++) {
+        bcache_buf *b = list[i];
+        int j = i;
+        while (j > 0 && list[j - 1]->block > b->block) {
+            list[j] = list[j - 1];
+            j--;
+        }
+        list[j] = b;
+    }
+    return count;
+}
+
+// Write a batch from collect_dirty. Called and returns locked, dropping
+// the lock for the I/O; a block that fails stays dirty.
+static int write_back(bcache_buf **list, int count, unsigned int *flags) {
+    blk_request reqs[BCACHE_BATCH];
+    blkdev *dev = list[0]->dev;
+    for (int i = 0; i < count; i++) {
+        list[i]->flags = (list[i]->flags & ~BUF_DIRTY) | BUF_BUSY;
+        list[i]->refs++;
+        stats.dirty--;
+    }
+    cache_unlock(*flags);
+    int result = transfer(dev, list, reqs, count, 1);
+    *flags = cache_lock();
+    for (int i = 0; i < count; i++) {
+        list[i]->flags &= ~BUF_BUSY;
+        list[i]->refs--;
+        if (reqs[i].status != 0) {
+            // A holder may have dirtied it again during the write
+            if (!(list[i]->flags & BUF_DIRTY)) {
+                list[i]->flags |= BUF_DIRTY;
+                stats.dirty++;
+            }
+        } else {
+            stats.writebacks++;
+        }
+    }
+    cache_unlock(*flags);
+    wait_queue_wake_all(&bcache_wq);
+    *flags = cache_lock();
+    if (result != 0) {
+        kprintf("bcache: write error on %s\n", dev->name);
+    }
+    return result;
+}
+
+// dev:block's buffer, held, with no I/O in flight; it has no valid data
+// if it was not cached. NULL when no room can be made. Called and returns
+// locked; may sleep.
+static bcache_buf *acquire(blkdev *dev, unsigned int block, unsigned int *flags) {
+    while (1) {
+        bcache_buf *b = lookup(dev, block);
+        if (b != NULL) {
+            b->refs++;
+            while (b->flags & BUF_BUSY) {
+                wait_queue_sleep(&bcache_wq);
+            }
+            lru_unlink(b);
+            lru_push_head(b);
+            return b;
+        }
+        b = find_victim(0);
+        if (b == NULL) {
+            // Everything is held; wait for a release
+            wait_queue_sleep(&bcache_wq);
+            continue;
+        }
+        if (b->flags & BUF_DIRTY) {
+            // Write it out along with other cold dirty blocks, then look
+            // again: the lock was dropped meanwhile
+            bcache_buf *list[BCACHE_BATCH];
+            if (write_back(list, collect_dirty(b, list), flags) == 0 ||
+                lookup(dev, block) != NULL) {
+                continue;
+            }
+            // The disk will not take it; make do with a clean buffer
+            if ((b = find_victim(1)) == NULL) {
+                return NULL;
+            }
+        }
+        claim(b, dev, block);
+        return b;
+    }
+}
+
+// Called locked. How many blocks past block to read ahead: none unless
+// block continues a known sequential reader, whose window then grows.
+static unsigned int stream_update(blkdev *dev, unsigned int block) {
+    for (int i = 0; i < BCACHE_STREAMS; i++) {
+        ra_stream *s = &streams[i];
+        if (s->dev != dev) {
+            continue;
+        }
+        if (s->next == block + 1) {
+            return 0; // The same block again
+        }
+        if (s->next == block) {
+            s->window = s->window ? s->window * 2 : BCACHE_RA_MIN;
+            if (s->window > stats.readahead_limit) {
+                s->window = stats.readahead_limit;
+            }
+            s->next = block + 1;
+            return s->window;
+        }
+    }
+    ra_stream *s = &streams[next_stream++ % BCACHE_STREAMS];
+    s->dev = dev;
+    s->next = block + 1;
+    s->window = 0;
+    return 0;
+}
+
+bcache_buf *bcache_read(blkdev *dev, unsigned int block) {
+    if (capacity == 0) {
+        return NULL;
+    }
+    unsigned int flags = cache_lock();
+    unsigned int window = stream_update(dev, block);
+    bcache_buf *b = acquire(dev, block, &flags);
+    if (b == NULL) {
+        cache_unlock(flags);
+        return NULL;
+    }
+    if (b->flags & BUF_VALID) {
+        stats.hits++;
+        if (b->flags & BUF_READAHEAD) {
+            b->flags &= ~BUF_READAHEAD;
+            stats.readahead_hits++;
+            if (stats.readahead_limit < BCACHE_RA_MAX) {
+                stats.readahead_limit++;
+            }
+        }
+        cache_unlock(flags);
+        return b;
+    }
+    stats.misses++;
+
+    // Read the following uncached blocks in the same batch, into buffers
+    // that can be had without writing anything back
+    bcache_buf *list[1 + BCACHE_RA_MAX];
+    int count = 0;
+    list[count++] = b;
+    b->flags |= BUF_BUSY;
+    unsigned int end = dev->sectors / BCACHE_SECTORS;
+    for (unsigned int next = block + 1; next <= block + window && next < end; next++) {
+        bcache_buf *ra;
+        if (lookup(dev, next) != NULL || (ra = find_victim(1)) == NULL) {
+            break;
+        }
+        claim(ra, dev, next);
+        ra->flags = BUF_BUSY | BUF_READAHEAD;
+        list[count++] = ra;
+    }
+    stats.readahead += count - 1;
+    cache_unlock(flags);
+
+    blk_request reqs[1 + BCACHE_RA_MAX];
+    transfer(dev, list, reqs, count, 0);
+
+    flags = cache_lock();
+    for (int i = 0; i < count; i++) {
+        list[i]->flags &= ~BUF_BUSY;
+        if (reqs[i].status == 0) {
+            list[i]->flags |= BUF_VALID;
+        } else {
+            list[i]->flags &= ~BUF_READAHEAD;
+        }
+        if (i > 0) {
+            list[i]->refs--;
+        }
+    }
+    int valid = b->flags & BUF_VALID;
+    if (!valid) {
+        b->refs--;
+    }
+    cache_unlock(flags);
+    wait_queue_wake_all(&bcache_wq);
+    return valid ? b : NULL;
+}
+
+bcache_buf *bcache_get(blkdev *dev, unsigned int block) {
+    if (capacity == 0) {
+        return NULL;
+    }
+    unsigned int flags = cache_lock();
+    bcache_buf *b = acquire(dev, block, &flags);
+    if (b != NULL) {
+        b->flags = (b->flags & ~BUF_READAHEAD) | BUF_VALID;
+    }
+    cache_unlock(flags);
+    return b;
+}
+
+void bcache_dirty(bcache_buf *b) {
+    unsigned int flags = cache_lock();
+    if (!(b->flags & BUF_DIRTY)) {
+        b->flags |= BUF_DIRTY;
+        stats.dirty++;
+    }
+    cache_unlock(flags);
+}
+
+void bcache_release(bcache_buf *b) {
+    unsigned int flags = cache_lock();
+    b->refs--;
+    int wake = b->refs == 0 && bcache_wq.threads.head != NULL;
+    cache_unlock(flags);
+    if (wake) {
+        wait_queue_wake_all(&bcache_wq);
+    }
+}
+
+int bcache_sync(void) {
+    bcache_buf *list[BCACHE_BATCH];
+    int result = 0;
+    unsigned int flags = cache_lock();
+    // Bounded, so blocks dirtied again meanwhile cannot keep us here
+    for (unsigned int round = 0; round <= capacity / BCACHE_BATCH; round++) {
+        int count = collect_dirty(NULL, list);
+        if (count == 0) {
+            break;
+        }
+        if (write_back(list, count, &flags) != 0) {
+            result = -1;
+            break;
+        }
+    }
+    cache_unlock(flags);
+    return result;
+}
+
+void bcache_get_stats(bcache_stats *out) {
+    unsigned int flags = cache_lock();
+    *out = stats;
+    cache_unlock(flags);
+}
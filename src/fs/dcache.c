@@ -0,0 +1,136 @@
+// dcache.c
+#include "dcache.h"
+#include "klib.h"
+
+typedef struct dentry {
+    fs_node *dir;                // NULL while unused
+    fs_node *node;               // NULL for a negative entry
+    unsigned int hash;
+    char name[MAX_FILENAME_LEN];
+    struct dentry *hash_next;
+    struct dentry **hash_pprev;
+    struct dentry *lru_prev;     // Towards the most recently used
+    struct dentry *lru_next;
+} dentry;
+
+static dentry dentries[DCACHE_ENTRIES];
+static dentry *buckets[DCACHE_BUCKETS];
+static dentry *lru_head;         // Most recently used
+static dentry *lru_tail;         // Next to be recycled
+
+static unsigned int bucket_of(fs_node *dir, unsigned int hash) {
+    return (hash ^ ((unsigned int)dir >> 4) * 2654435761u) & (DCACHE_BUCKETS - 1);
+}
+
+static void lru_unlink(dentry *d) {
+    if (d->lru_prev) d->lru_prev->lru_next = d->lru_next;
+    else lru_head = d->lru_next;
+    if (d->lru_next) d->lru_next->lru_prev = d->lru_prev;
+    else lru_tail = d->lru_prev;
+}
+
+static void lru_push_head(dentry *d) {
+    d->lru_prev = NULL;
+    d->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = d;
+    else lru_tail = d;
+    lru_head = d;
+}
+
+static void lru_push_tail(dentry *d) {
+    d->lru_next = NULL;
+    d->lru_prev = lru_tail;
+    if (lru_tail) lru_tail->lru_next = d;
+    else lru_head = d;
+    lru_tail = d;
+}
+
+static void unhash(dentry *d) {
+    if (d->dir == NULL) {
+        return;
+    }
+    *d->hash_pprev = d->hash_next;
+    if (d->hash_next) {
+        d->hash_next->hash_pprev = d->hash_pprev;
+    }
+    d->dir = NULL;
+}
+
+// Unused entries go to the tail so they are recycled first
+static void release(dentry *d) {
+    unhash(d);
+    lru_unlink(d);
+    lru_push_tail(d);
+}
+
+void dcache_init(void) {
+    lru_head = NULL;
+    lru_tail = NULL;
+    for (int i = 0; i < DCACHE_BUCKETS; i++) {
+        buckets[i] = NULL;
+    }
+    for (int i = 0; i < DCACHE_ENTRIES; i++) {
+        dentries[i].dir = NULL;
+        lru_push_tail(&dentries[i]);
+    }
+}
+
+static dentry *find(fs_node *dir, const char *name, unsigned int hash) {
+    for (dentry *d = buckets[bucket_of(dir, hash)]; d != NULL; d = d->hash_next) {
+        if (d->dir == dir && d->hash == hash && kstreq(d->name, name)) {
+            return d;
+        }
+    }
+    return NULL;
+}
+
+int dcache_lookup(fs_node *dir, const char *name, unsigned int hash,
+                  fs_node **node) {
+    dentry *d = find(dir, name, hash);
+    if (d == NULL) {
+        return 0;
+    }
+    lru_unlink(d);
+    lru_push_head(d);
+    *node = d->node;
+    return 1;
+}
+
+void dcache_insert(fs_node *dir, const char *name, unsigned int hash,
+                   fs_node *node) {
+    dentry *d = find(dir, name, hash);
+    if (d == NULL) {
+        d = lru_tail;
+        unhash(d);
+        kstrcpy(d->name, name);
+        d->dir = dir;
+        d->hash = hash;
+        dentry **bucket = &buckets[bucket_of(dir, hash)];
+        d->hash_next = *bucket;
+        if (*bucket) {
+            (*bucket)->hash_pprev = &d->hash_next;
+        }
+        *bucket = d;
+        d->hash_pprev = bucket;
+    }
+    d->node = node;
+    lru_unlink(d);
+    lru_push_head(d);
+}
+
+void dcache_invalidate(fs_node *dir, const char *name, unsigned int hash) {
+    dentry *d = find(dir, name, hash);
+    if (d != NULL) {
+        release(d);
+    }
+}
+
+// Only negative entries can point into a directory that is being removed
+// (it must be empty), but they would turn stale if its node were reused
+void dcache_purge_dir(fs_node *dir) {
+    for (int i = 0; i < DCACHE_ENTRIES; i++) {
+        if (dentries[i].dir == dir || (dentries[i].dir != NULL && dentries[i].node == dir)) {
+            release(&dentries[i]);
+        }
+    }
+}
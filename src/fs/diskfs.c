@@ -0,0 +1,524 @@
+// diskfs.c
+#include "diskfs.h"
+#include "bcache.h"
+#include "klib.h"
+#include "heap.h"
+#include "kprintf.h"
+
+#define BITMAP_BITS_PER_BLOCK (DISKFS_BLOCK_SIZE * 8)
+#define MIN_BLOCKS 64
+
+_Static_assert(sizeof(diskfs_inode) == DISKFS_INODE_SIZE, "diskfs_inode size");
+_Static_assert(DISKFS_BLOCK_SIZE == BCACHE_BLOCK_SIZE, "diskfs block size");
+
+static blkdev *disk;
+static diskfs_super super;
+static int mounted;
+static unsigned char *bitmap;           // Read in at the first allocation
+static unsigned int alloc_hint;         // Lowest block that may be free
+static unsigned int inode_hint;         // Lowest inode that may be free
+
+// All block I/O goes through the buffer cache; writes reach the disk
+// when it writes them back
+static int block_read(unsigned int block, void *buf) {
+    bcache_buf *b = bcache_read(disk, block);
+    if (b == NULL) {
+        kprintf("disk: read error at block %u\n", block);
+        return -1;
+    }
+    kmemcpy(buf, b->data, DISKFS_BLOCK_SIZE);
+    bcache_release(b);
+    return 0;
+}
+
+static int block_write(unsigned int block, const void *buf) {
+    bcache_buf *b = bcache_get(disk, block);
+    if (b == NULL) {
+        kprintf("disk: write error at block %u\n", block);
+        return -1;
+    }
+    kmemcpy(b->data, buf, DISKFS_BLOCK_SIZE);
+    bcache_dirty(b);
+    bcache_release(b);
+    return 0;
+}
+
+// The inode table block holding ino, held in the cache
+static bcache_buf *inode_block(unsigned int ino) {
+    if (ino == 0 || ino >= super.inode_count) {
+        return NULL;
+    }
+    bcache_buf *b = bcache_read(disk, super.inode_start + ino / DISKFS_INODES_PER_BLOCK);
+    if (b == NULL) {
+        kprintf("disk: cannot read inode %u\n", ino);
+    }
+    return b;
+}
+
+static int inode_read(unsigned int ino, diskfs_inode *inode) {
+    bcache_buf *b = inode_block(ino);
+    if (b == NULL) {
+        return -1;
+    }
+    kmemcpy(inode, b->data + (ino % DISKFS_INODES_PER_BLOCK) * DISKFS_INODE_SIZE,
+            sizeof(diskfs_inode));
+    bcache_release(b);
+    return 0;
+}
+
+static int inode_write(unsigned int ino, const diskfs_inode *inode) {
+    bcache_buf *b = inode_block(ino);
+    if (b == NULL) {
+        return -1;
+    }
+    kmemcpy(b->data + (ino % DISKFS_INODES_PER_BLOCK) * DISKFS_INODE_SIZE, inode,
+            sizeof(diskfs_inode));
+    bcache_dirty(b);
+    bcache_release(b);
+    return 0;
+}
+
+static int bitmap_load(void) {
+    if (bitmap != NULL) {
+        return 0;
+    }
+    bitmap = kmalloc(super.bitmap_blocks * DISKFS_BLOCK_SIZE);
+    if (bitmap == NULL) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < super.bitmap_blocks; i++) {
+        if (block_read(super.bitmap_start + i, bitmap + i * DISKFS_BLOCK_SIZE) != 0) {
+            kfree(bitmap);
+            bitmap = NULL;
+            return -1;
+        }
+    }
+    alloc_hint = super.data_start;
+    return 0;
+}
+
+// Copy the bitmap block holding block's bit to the cache
+static int bitmap_sync(unsigned int block) {
+    unsigned int index = block / BITMAP_BITS_PER_BLOCK;
+    return block_write(super.bitmap_start + index, bitmap + index * DISKFS_BLOCK_SIZE);
+}
+
+static unsigned int block_alloc(void) {
+    if (bitmap_load() != 0) {
+        return 0;
+    }
+    for (unsigned int block = alloc_hint; block < super.block_count; block++) {
+        if (!(bitmap[block / 8] & (1 << (block % 8)))) {
+            bitmap[block / 8] |= 1 << (block % 8);
+            if (bitmap_sync(block) != 0) {
+                bitmap[block / 8] &= ~(1 << (block % 8));
+                return 0;
+            }
+            alloc_hint = block + 1;
+            return block;
+        }
+    }
+    kprintf("disk: full\n");
+    return 0;
+}
+
+static void block_free(unsigned int block) {
+    if (block < super.data_start || block >= super.block_count ||
+        bitmap_load() != 0) {
+        return;
+    }
+    bitmap[block / 8] &= ~(1 << (block % 8));
+    bitmap_sync(block);
+    if (block < alloc_hint) {
+        alloc_hint = block;
+    }
+}
+
+// Block holding a file's block index, allocating it (and the indirect
+// block) when alloc is set. Sets *dirty when the inode itself changed.
+static unsigned int bmap(diskfs_inode *inode, unsigned int index, int alloc,
+                         int *dirty) {
+    if (index < DISKFS_DIRECT) {
+        if (inode->direct[index] == 0 && alloc) {
+            inode->direct[index] = block_alloc();
+            *dirty = inode->direct[index] != 0;
+        }
+        return inode->direct[index];
+    }
+    index -= DISKFS_DIRECT;
+    if (index >= DISKFS_PER_INDIRECT) {
+        return 0;
+    }
+
+    unsigned int *table = kmalloc(DISKFS_BLOCK_SIZE);
+    if (table == NULL) {
+        return 0;
+    }
+    int new_indirect = inode->indirect == 0;
+    if (new_indirect) {
+        if (!alloc || (inode->indirect = block_alloc()) == 0) {
+            kfree(table);
+            return 0;
+        }
+        *dirty = 1;
+        kmemset(table, 0, DISKFS_BLOCK_SIZE);
+    } else if (block_read(inode->indirect, table) != 0) {
+        kfree(table);
+        return 0;
+    }
+
+    unsigned int block = table[index];
+    if (block == 0 && alloc) {
+        block = block_alloc();
+        table[index] = block;
+        if (block != 0 && block_write(inode->indirect, table) != 0) {
+            block_free(block);
+            block = 0;
+        }
+    }
+    // Callers only write the inode back on success, so an indirect block
+    // allocated for nothing would be left marked in use forever
+    if (block == 0 && new_indirect) {
+        block_free(inode->indirect);
+        inode->indirect = 0;
+        *dirty = 0;
+    }
+    kfree(table);
+    return block;
+}
+
+static int format(void) {
+    unsigned int blocks = disk->sectors / DISKFS_SECTORS_PER_BLOCK;
+    if (blocks < MIN_BLOCKS) {
+        return -1;
+    }
+    kmemset(&super, 0, sizeof(super));
+    super.magic = DISKFS_MAGIC;
+    super.version = DISKFS_VERSION;
+    super.block_count = blocks;
+    super.inode_blocks = (blocks / DISKFS_INODE_RATIO + DISKFS_INODES_PER_BLOCK - 1) /
+                         DISKFS_INODES_PER_BLOCK;
+    super.inode_count = super.inode_blocks * DISKFS_INODES_PER_BLOCK;
+    super.bitmap_blocks = (blocks + DISKFS_BLOCK_SIZE * 8 - 1) / (DISKFS_BLOCK_SIZE * 8);
+    super.bitmap_start = 1;
+    super.inode_start = super.bitmap_start + super.bitmap_blocks;
+    super.data_start = super.inode_start + super.inode_blocks;
+
+    unsigned char *buf = kzalloc(DISKFS_BLOCK_SIZE);
+    if (buf == NULL) {
+        return -1;
+    }
+    int result = 0;
+    for (unsigned int i = 0; i < super.inode_blocks && result == 0; i++) {
+        result = block_write(super.inode_start + i, buf);
+    }
+    // Everything before data_start is in use from the start
+    for (unsigned int i = 0; i < super.bitmap_blocks && result == 0; i++) {
+        kmemset(buf, 0, DISKFS_BLOCK_SIZE);
+        for (unsigned int bit = 0; bit < DISKFS_BLOCK_SIZE * 8; bit++) {
+            unsigned int block = i * DISKFS_BLOCK_SIZE * 8 + bit;
+            if (block >= super.data_start) {
+                break;
+            }
+            buf[bit / 8] |= 1 << (bit % 8);
+        }
+        result = block_write(super.bitmap_start + i, buf);
+    }
+    if (result == 0) {
+        diskfs_inode root;
+        kmemset(&root, 0, sizeof(root));
+        root.type = DISKFS_TYPE_DIR;
+        result = inode_write(DISKFS_ROOT_INO, &root);
+    }
+    if (result == 0) {
+        // The superblock goes last: a format cut short is still blank
+        result = bcache_sync();
+    }
+    if (result == 0) {
+        kmemset(buf, 0, DISKFS_BLOCK_SIZE);
+        kmemcpy(buf, &super, sizeof(super));
+        result = block_write(0, buf);
+    }
+    if (result == 0) {
+        result = bcache_sync();
+    }
+    kfree(buf);
+    return result;
+}
+
+static int all_zero(const unsigned char *buf, unsigned int len) {
+    for (unsigned int i = 0; i < len; i++) {
+        if (buf[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int diskfs_mount(blkdev *dev) {
+    if (dev == NULL) {
+        return -1;
+    }
+    disk = dev;
+    unsigned char *buf = kmalloc(DISKFS_BLOCK_SIZE);
+    if (buf == NULL || block_read(0, buf) != 0) {
+        kfree(buf);
+        return -1;
+    }
+    kmemcpy(&super, buf, sizeof(super));
+    int blank = all_zero(buf, DISKFS_BLOCK_SIZE);
+    kfree(buf);
+
+    if (super.magic != DISKFS_MAGIC || super.version != DISKFS_VERSION) {
+        if (!blank) {
+            vga_puts("disk: unknown format, not mounted\n");
+            return -1;
+        }
+        vga_puts("disk: blank, formatting\n");
+        if (format() != 0) {
+            vga_puts("disk: format failed\n");
+            return -1;
+        }
+    }
+    inode_hint = DISKFS_ROOT_INO + 1;
+    mounted = 1;
+    kprintf("disk: %s mounted, %u blocks, %u inodes\n", dev->name,
+            super.block_count, super.inode_count);
+    return 0;
+}
+
+int diskfs_mounted(void) {
+    return mounted;
+}
+
+blkdev *diskfs_device(void) {
+    return mounted ? disk : NULL;
+}
+
+int diskfs_read_dir(unsigned int dir_ino, diskfs_dirent_fn fn, void *ctx) {
+    diskfs_inode dir;
+    if (inode_read(dir_ino, &dir) != 0) {
+        return -1;
+    }
+    diskfs_dirent *entries = kmalloc(DISKFS_BLOCK_SIZE);
+    if (entries == NULL) {
+        return -1;
+    }
+    int dirty = 0;
+    int result = 0;
+    for (unsigned int b = 0; b < dir.size / DISKFS_BLOCK_SIZE && result == 0; b++) {
+        unsigned int block = bmap(&dir, b, 0, &dirty);
+        if (block == 0 || block_read(block, entries) != 0) {
+            result = -1;
+            break;
+        }
+        for (unsigned int i = 0; i < DISKFS_DIRENTS_PER_BLOCK; i++) {
+            diskfs_inode child;
+            if (entries[i].ino == 0) {
+                continue;
+            }
+            if (inode_read(entries[i].ino, &child) != 0) {
+                result = -1;
+                break;
+            }
+            entries[i].name[MAX_FILENAME_LEN - 1] = '\0';
+            fn(ctx, entries[i].name, entries[i].ino,
+               child.type == DISKFS_TYPE_DIR ? TYPE_DIRECTORY : TYPE_FILE,
+               child.size);
+        }
+    }
+    kfree(entries);
+    return result;
+}
+
+static unsigned int inode_alloc(unsigned short type) {
+    diskfs_inode inode;
+    for (unsigned int ino = inode_hint; ino < super.inode_count; ino++) {
+        if (inode_read(ino, &inode) != 0) {
+            return 0;
+        }
+        if (inode.type == DISKFS_TYPE_FREE) {
+            kmemset(&inode, 0, sizeof(inode));
+            inode.type = type;
+            if (inode_write(ino, &inode) != 0) {
+                return 0;
+            }
+            inode_hint = ino + 1;
+            return ino;
+        }
+    }
+    vga_puts("disk: out of inodes\n");
+    return 0;
+}
+
+// Put an entry in the first free slot, growing the directory by a block
+// when there is none
+static int dir_add(unsigned int dir_ino, const char *name, unsigned int ino) {
+    diskfs_inode dir;
+    if (inode_read(dir_ino, &dir) != 0) {
+        return -1;
+    }
+    diskfs_dirent *entries = kmalloc(DISKFS_BLOCK_SIZE);
+    if (entries == NULL) {
+        return -1;
+    }
+    int dirty = 0;
+    unsigned int blocks = dir.size / DISKFS_BLOCK_SIZE;
+    for (unsigned int b = 0; b <= blocks; b++) {
+        unsigned int block = bmap(&dir, b, b == blocks, &dirty);
+        if (block == 0) {
+            break;
+        }
+        if (b == blocks) {
+            kmemset(entries, 0, DISKFS_BLOCK_SIZE);
+            dir.size += DISKFS_BLOCK_SIZE;
+            dirty = 1;
+        } else if (block_read(block, entries) != 0) {
+            break;
+        }
+        for (unsigned int i = 0; i < DISKFS_DIRENTS_PER_BLOCK; i++) {
+            if (entries[i].ino != 0) {
+                continue;
+            }
+            entries[i].ino = ino;
+            kmemset(entries[i].name, 0, MAX_FILENAME_LEN);
+            kstrcpy(entries[i].name, name);
+            int result = block_write(block, entries);
+            if (result == 0 && dirty) {
+                result = inode_write(dir_ino, &dir);
+            }
+            kfree(entries);
+            return result;
+        }
+    }
+    kfree(entries);
+    return -1;
+}
+
+unsigned int diskfs_create(unsigned int dir_ino, const char *name,
+                           fs_node_type type) {
+    unsigned int ino = inode_alloc(type == TYPE_DIRECTORY ? DISKFS_TYPE_DIR
+                                                          : DISKFS_TYPE_FILE);
+    if (ino == 0) {
+        return 0;
+    }
+    if (dir_add(dir_ino, name, ino) != 0) {
+        diskfs_free(ino);
+        return 0;
+    }
+    return ino;
+}
+
+int diskfs_unlink(unsigned int dir_ino, const char *name) {
+    diskfs_inode dir;
+    if (inode_read(dir_ino, &dir) != 0) {
+        return -1;
+    }
+    diskfs_dirent *entries = kmalloc(DISKFS_BLOCK_SIZE);
+    if (entries == NULL) {
+        return -1;
+    }
+    int dirty = 0;
+    int result = -1;
+    for (unsigned int b = 0; b < dir.size / DISKFS_BLOCK_SIZE; b++) {
+        unsigned int block = bmap(&dir, b, 0, &dirty);
+        if (block == 0 || block_read(block, entries) != 0) {
+            break;
+        }
+        for (unsigned int i = 0; i < DISKFS_DIRENTS_PER_BLOCK; i++) {
+            entries[i].name[MAX_FILENAME_LEN - 1] = '\0';
+            if (entries[i].ino != 0 && kstreq(entries[i].name, name)) {
+                entries[i].ino = 0;
+                result = block_write(block, entries);
+                kfree(entries);
+                return result;
+            }
+        }
+    }
+    kfree(entries);
+    return result;
+}
+
+int diskfs_free(unsigned int ino) {
+    diskfs_inode inode;
+    if (diskfs_set_size(ino, 0) != 0 || inode_read(ino, &inode) != 0) {
+        return -1;
+    }
+    inode.type = DISKFS_TYPE_FREE;
+    if (inode_write(ino, &inode) != 0) {
+        return -1;
+    }
+    if (ino < inode_hint) {
+        inode_hint = ino;
+    }
+    return 0;
+}
+
+bcache_buf *diskfs_block(unsigned int ino, unsigned int index, int alloc) {
+    diskfs_inode inode;
+    int dirty = 0;
+    if (index >= DISKFS_MAX_BLOCKS || inode_read(ino, &inode) != 0) {
+        return NULL;
+    }
+    unsigned int block = bmap(&inode, index, 0, &dirty);
+    if (block != 0) {
+        bcache_buf *b = bcache_read(disk, block);
+        if (b == NULL) {
+            kprintf("disk: read error at block %u\n", block);
+        }
+        return b;
+    }
+    if (!alloc || (block = bmap(&inode, index, 1, &dirty)) == 0) {
+        return NULL;
+    }
+    if (dirty && inode_write(ino, &inode) != 0) {
+        return NULL;
+    }
+    // A new block was a hole, so it starts out as zeros, not whatever the
+    // disk held there
+    bcache_buf *b = bcache_get(disk, block);
+    if (b == NULL) {
+        kprintf("disk: write error at block %u\n", block);
+        return NULL;
+    }
+    kmemset(b->data, 0, DISKFS_BLOCK_SIZE);
+    bcache_dirty(b);
+    return b;
+}
+
+int diskfs_set_size(unsigned int ino, size_t size) {
+    diskfs_inode inode;
+    if (inode_read(ino, &inode) != 0) {
+        return -1;
+    }
+    unsigned int keep = (size + DISKFS_BLOCK_SIZE - 1) / DISKFS_BLOCK_SIZE;
+    for (unsigned int i = keep; i < DISKFS_DIRECT; i++) {
+        block_free(inode.direct[i]);
+        inode.direct[i] = 0;
+    }
+    if (inode.indirect != 0) {
+        unsigned int *table = kmalloc(DISKFS_BLOCK_SIZE);
+        if (table == NULL || block_read(inode.indirect, table) != 0) {
+            kfree(table);
+            return -1;
+        }
+        unsigned int first = keep > DISKFS_DIRECT ? keep - DISKFS_DIRECT : 0;
+        int changed = 0;
+        for (unsigned int i = first; i < DISKFS_PER_INDIRECT; i++) {
+            if (table[i] != 0) {
+                block_free(table[i]);
+                table[i] = 0;
+                changed = 1;
+            }
+        }
+        if (first == 0) {
+            block_free(inode.indirect);
+            inode.indirect = 0;
+        } else if (changed) {
+            block_write(inode.indirect, table);
+        }
+        kfree(table);
+    }
+    inode.size = size;
+    return inode_write(ino, &inode);
+}
@@ -0,0 +1,171 @@
+// file.c
+#include "file.h"
+#include "heap.h"
+#include "bcache.h"
+
+// A table belongs to its thread: only it opens and closes descriptors
+// there, or thread_exit on its behalf. The filesystem lock covers the
+// files themselves.
+static fs_file *fd_get(thread *t, int fd) {
+    if (fd < 0 || fd >= THREAD_MAX_FILES) {
+        return NULL;
+    }
+    return t->files[fd];
+}
+
+static int open_locked(const char *path, int flags) {
+    fs_file **files = thread_current()->files;
+    if (path == NULL || (flags & (FS_O_READ | FS_O_WRITE)) == 0) {
+        return -1;
+    }
+    int fd = 0;
+    while (fd < THREAD_MAX_FILES && files[fd] != NULL) {
+        fd++;
+    }
+    if (fd == THREAD_MAX_FILES) {
+        return -1;
+    }
+
+    fs_node *node = fs_lookup(path);
+    if (node == NULL && (flags & FS_O_CREATE)) {
+        node = fs_create(path, TYPE_FILE);
+    }
+    if (node == NULL || node->type != TYPE_FILE) {
+        return -1;
+    }
+    fs_file *file = kmalloc(sizeof(fs_file));
+    if (file == NULL) {
+        return -1;
+    }
+    if ((flags & FS_O_TRUNC) && (flags & FS_O_WRITE)) {
+        fs_file_truncate(node, 0);
+    }
+
+    file->node = node;
+    file->offset = 0;
+    file->flags = flags;
+    file->view = NULL;
+    fs_node_hold(node);
+    files[fd] = file;
+    return fd;
+}
+
+int fs_open(const char *path, int flags) {
+    fs_lock();
+    int result = open_locked(path, flags);
+    fs_unlock();
+    return result;
+}
+
+static int close_locked(thread *t, int fd) {
+    fs_file *file = fd_get(t, fd);
+    if (file == NULL) {
+        return -1;
+    }
+    t->files[fd] = NULL;
+    if (file->view != NULL) {
+        bcache_release(file->view);
+    }
+    fs_node_release(file->node);
+    kfree(file);
+    return 0;
+}
+
+int fs_close(int fd) {
+    fs_lock();
+    int result = close_locked(thread_current(), fd);
+    fs_unlock();
+    return result;
+}
+
+void fs_close_all(thread *t) {
+    fs_lock();
+    for (int fd = 0; fd < THREAD_MAX_FILES; fd++) {
+        close_locked(t, fd);
+    }
+    fs_unlock();
+}
+
+static int read_locked(int fd, void *buf, size_t len) {
+    fs_file *file = fd_get(thread_current(), fd);
+    if (file == NULL || !(file->flags & FS_O_READ)) {
+        return -1;
+    }
+    int done = fs_file_read(file->node, file->offset, buf, len);
+    file->offset += done;
+    return done;
+}
+
+int fs_read(int fd, void *buf, size_t len) {
+    fs_lock();
+    int result = read_locked(fd, buf, len);
+    fs_unlock();
+    return result;
+}
+
+static const char *read_view_locked(int fd, size_t *len) {
+    fs_file *file = fd_get(thread_current(), fd);
+    if (file == NULL || !(file->flags & FS_O_READ)) {
+        *len = 0;
+        return NULL;
+    }
+    if (file->view != NULL) {
+        bcache_release(file->view);
+    }
+    const char *data = fs_file_view(file->node, file->offset, len, &file->view);
+    file->offset += *len;
+    return data;
+}
+
+const char *fs_read_view(int fd, size_t *len) {
+    fs_lock();
+    const char *result = read_view_locked(fd, len);
+    fs_unlock();
+    return result;
+}
+
+static int write_at_locked(int fd, size_t offset, const void *buf, size_t len) {
+    fs_file *file = fd_get(thread_current(), fd);
+    if (file == NULL || !(file->flags & FS_O_WRITE)) {
+        return -1;
+    }
+    return fs_file_write(file->node, offset, buf, len);
+}
+
+int fs_write_at(int fd, size_t offset, const void *buf, size_t len) {
+    fs_lock();
+    int result = write_at_locked(fd, offset, buf, len);
+    fs_unlock();
+    return result;
+}
+
+static int seek_locked(int fd, int offset, int whence) {
+    fs_file *file = fd_get(thread_current(), fd);
+    if (file == NULL) {
+        return -1;
+    }
+    long long base;
+    if (whence == FS_SEEK_SET) {
+        base = 0;
+    } else if (whence == FS_SEEK_CUR) {
+        base = file->offset;
+    } else if (whence == FS_SEEK_END) {
+        base = file->node->size;
+    } else {
+        return -1;
+    }
+    // Past the end is fine: reads return 0 there, writes leave a hole
+    long long target = base + offset;
+    if (target < 0 || target > 0x7FFFFFFF) {
+        return -1;
+    }
+    file->offset = (size_t)target;
+    return (int)target;
+}
+
+int fs_seek(int fd, int offset, int whence) {
+    fs_lock();
+    int result = seek_locked(fd, offset, whence);
+    fs_unlock();
+    return result;
+}
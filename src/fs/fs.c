@@ -2,204 +2,915 @@
 #include "fs.h"
 #include "vga.h"
 #include "klib.h"
+#include "heap.h"
+#include "kprintf.h"
+#include "strbuf.h"
+#include "dcache.h"
+#include "diskfs.h"
+#include "pmm.h"
+#include "sched.h"
+
+#define LS_DIR_ATTR VGA_ATTR(VGA_LIGHT_BLUE, VGA_BLACK)
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+#define ENTRY_DELETED ((fs_node *)1)    // Tombstone in a directory table
+
+#define NODE_SLAB_SIZE PAGE_SIZE  // kmalloc serves this from whole, aligned pages
+#define NAME_BUCKETS 256
+
+// Nodes come from page-sized slabs of FS_NODE_SIZE slots. The first slot
+// holds this header, so every node starts on a cache line of its own and
+// its slab is found by rounding its address down.
+typedef struct node_slab {
+    struct node_slab *next;      // Slabs with at least one free node
+    struct node_slab *prev;
+    fs_node *free_list;          // Linked through next
+    unsigned int in_use;
+} node_slab;
+
+_Static_assert(sizeof(fs_node) <= FS_NODE_SIZE, "fs_node outgrew its slot");
+_Static_assert(sizeof(node_slab) <= FS_NODE_SIZE, "node_slab outgrew its slot");
+
+// An interned name. Nodes point at text, which every node of the same
+// name shares; the last reference gone, the name is freed.
+typedef struct fs_name {
+    struct fs_name *next;        // Hash chain
+    unsigned int hash;
+    unsigned int refs;
+    char text[];
+} fs_name;
 
 static fs_node root_dir;
+static fs_dir root_entries;
 static fs_node *current_dir;
-static fs_node nodes[MAX_DIRS + MAX_FILES];
-static int node_count = 0;
+static node_slab *node_partial;
+static fs_name *names[NAME_BUCKETS];
 
-void fs_init(void) {
+static mutex fs_mutex = MUTEX_INIT;
+static thread *fs_owner;         // Holder of fs_mutex, for nesting
+static unsigned int fs_depth;
+
+void fs_lock(void) {
+    thread *self = thread_current();
+    // Only ever equal to self if we set it, so reading it unlocked is safe
+    if (fs_owner == self) {
+        fs_depth++;
+        return;
+    }
+    mutex_lock(&fs_mutex);
+    fs_owner = self;
+    fs_depth = 1;
+}
+
+void fs_unlock(void) {
+    if (--fs_depth == 0) {
+        fs_owner = NULL;
+        mutex_unlock(&fs_mutex);
+    }
+}
+
+static void init_locked(void) {
     // Initialize root directory
-    kstrcpy(root_dir.name, "/");
+    root_dir.name = "/";
+    root_dir.name_hash = fs_name_hash("/");
     root_dir.type = TYPE_DIRECTORY;
-    root_dir.data = NULL;
     root_dir.size = 0;
-    root_dir.capacity = 0;
+    root_dir.extents = NULL;
+    root_dir.extent_slots = 0;
     root_dir.parent = NULL;
-    root_dir.children = NULL;
     root_dir.next = NULL;
+    root_dir.prev = NULL;
+    root_dir.open_count = 0;
+    root_dir.ino = 0;
+    root_dir.dir = &root_entries;
+    kmemset(&root_entries, 0, sizeof(root_entries));
     
     current_dir = &root_dir;
-    node_count = 1;
+    dcache_init();
+
+    // The tree is read in a directory at a time, as it is walked, from
+    // the first disk found
+    if (diskfs_mount(blkdev_get(0)) == 0) {
+        root_dir.ino = DISKFS_ROOT_INO;
+        root_entries.unloaded = 1;
+    }
+}
+
+void fs_init(void) {
+    fs_lock();
+    init_locked();
+    fs_unlock();
+}
+
+static void node_slab_unlink(node_slab *s) {
+    if (s->prev != NULL) {
+        s->prev->next = s->next;
+    } else {
+        node_partial = s->next;
+    }
+    if (s->next != NULL) {
+        s->next->prev = s->prev;
+    }
+    s->next = NULL;
+    s->prev = NULL;
+}
+
+static void node_slab_push(node_slab *s) {
+    s->prev = NULL;
+    s->next = node_partial;
+    if (s->next != NULL) {
+        s->next->prev = s;
+    }
+    node_partial = s;
 }
 
-fs_node *fs_create_node(const char *name, fs_node_type type) {
-    if (node_count >= MAX_DIRS + MAX_FILES) {
+static fs_node *node_alloc(void) {
+    node_slab *s = node_partial;
+    if (s == NULL) {
+        s = kmalloc(NODE_SLAB_SIZE);
+        if (s == NULL) {
+            return NULL;
+        }
+        s->in_use = 0;
+        fs_node **link = &s->free_list;
+        for (unsigned int off = FS_NODE_SIZE; off < NODE_SLAB_SIZE;
+             off += FS_NODE_SIZE) {
+            fs_node *node = (fs_node *)((char *)s + off);
+            *link = node;
+            link = &node->next;
+        }
+        *link = NULL;
+        node_slab_push(s);
+    }
+
+    fs_node *node = s->free_list;
+    s->free_list = node->next;
+    s->in_use++;
+    if (s->free_list == NULL) {
+        node_slab_unlink(s);
+    }
+    return node;
+}
+
+// Back on its slab's free list at once; an empty slab goes back to the
+// heap unless it is the last one with room, so churn doesn't thrash
+static void node_free(fs_node *node) {
+    node_slab *s = (node_slab *)((unsigned int)node & ~(NODE_SLAB_SIZE - 1));
+    int was_full = s->free_list == NULL;
+
+    node->next = s->free_list;
+    s->free_list = node;
+    s->in_use--;
+
+    if (was_full) {
+        node_slab_push(s);
+    }
+    if (s->in_use == 0 && (s->prev != NULL || s->next != NULL)) {
+        node_slab_unlink(s);
+        kfree(s);
+    }
+}
+
+static const char *name_intern(const char *name, unsigned int hash) {
+    fs_name **bucket = &names[hash & (NAME_BUCKETS - 1)];
+    for (fs_name *n = *bucket; n != NULL; n = n->next) {
+        if (n->hash == hash && kstreq(n->text, name)) {
+            n->refs++;
+            return n->text;
+        }
+    }
+
+    unsigned int len = kstrlen(name);
+    fs_name *n = kmalloc(sizeof(fs_name) + len + 1);
+    if (n == NULL) {
+        return NULL;
+    }
+    n->hash = hash;
+    n->refs = 1;
+    kmemcpy(n->text, name, len + 1);
+    n->next = *bucket;
+    *bucket = n;
+    return n->text;
+}
+
+static void name_release(const char *text) {
+    fs_name *n = (fs_name *)(text - offsetof(fs_name, text));
+    if (--n->refs > 0) {
+        return;
+    }
+    fs_name **link = &names[n->hash & (NAME_BUCKETS - 1)];
+    while (*link != n) {
+        link = &(*link)->next;
+    }
+    *link = n->next;
+    kfree(n);
+}
+
+static fs_node *node_create(const char *name, fs_node_type type) {
+    fs_node *node = node_alloc();
+    if (node == NULL) {
+        return NULL;
+    }
+    node->name_hash = fs_name_hash(name);
+    node->name = name_intern(name, node->name_hash);
+    node->dir = type == TYPE_DIRECTORY ? kzalloc(sizeof(fs_dir)) : NULL;
+    if (node->name == NULL || (type == TYPE_DIRECTORY && node->dir == NULL)) {
+        if (node->name != NULL) {
+            name_release(node->name);
+        }
+        kfree(node->dir);
+        node_free(node);
         return NULL;
     }
-    
-    fs_node *node = &nodes[node_count++];
-    kstrcpy(node->name, name);
     node->type = type;
-    node->data = NULL;
     node->size = 0;
-    node->capacity = 0;
-    node->parent = current_dir;
-    node->children = NULL;
+    node->extents = NULL;
+    node->extent_slots = 0;
+    node->parent = NULL;     // Set by fs_dir_link
     node->next = NULL;
+    node->prev = NULL;
+    node->slot = 0;
+    node->open_count = 0;
+    node->ino = 0;
     
     return node;
 }
 
-fs_node *fs_find_file(const char *filename) {
-    fs_node *current = current_dir->children;
-    while (current != NULL) {
-        if (kstreq(current->name, filename) && current->type == TYPE_FILE) {
-            return current;
+static void extents_free(fs_node *file) {
+    for (unsigned int i = 0; i < file->extent_slots; i++) {
+        kfree(file->extents[i]);
+    }
+    kfree(file->extents);
+    file->extents = NULL;
+    file->extent_slots = 0;
+}
+
+// Free an unlinked node with everything it owns, on disk too
+static void node_destroy(fs_node *node) {
+    extents_free(node);
+    if (node->ino != 0) {
+        diskfs_free(node->ino);
+    }
+    if (node->dir != NULL) {
+        kfree(node->dir->entries);
+        kfree(node->dir->path);
+        kfree(node->dir);
+    }
+    name_release(node->name);
+    node_free(node);
+}
+
+unsigned int fs_name_hash(const char *name) {
+    unsigned int hash = FNV_OFFSET_BASIS;
+    while (*name) {
+        hash = (hash ^ (unsigned char)*name++) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static void load_entry(void *ctx, const char *name, unsigned int ino,
+                       fs_node_type type, size_t size) {
+    fs_node *dir = ctx;
+    fs_node *node = node_create(name, type);
+    if (node == NULL) {
+        return;
+    }
+    if (fs_dir_link(dir, node) != 0) {
+        node_destroy(node);
+        return;
+    }
+    node->ino = ino;  // Only now: destroying it must not free the inode
+    if (type == TYPE_FILE) {
+        node->size = size;
+    } else {
+        node->dir->unloaded = 1;
+    }
+}
+
+// Bring in a disk directory's entries the first time it is looked at
+static void dir_load(fs_node *dir) {
+    if (dir->dir->unloaded) {
+        dir->dir->unloaded = 0;
+        if (diskfs_read_dir(dir->ino, load_entry, dir) != 0) {
+            kprintf("disk: cannot read directory %s\n", dir->name);
         }
-        current = current->next;
     }
-    return NULL;
 }
 
-fs_node *fs_find_dir(const char *dirname) {
-    fs_node *current = current_dir->children;
-    while (current != NULL) {
-        if (kstreq(current->name, dirname) && current->type == TYPE_DIRECTORY) {
-            return current;
+// Linear probing from the hash's home slot. Names are compared only when
+// the full 32-bit hashes match, so a miss rarely touches a string.
+static fs_node *dir_lookup(fs_node *dir, const char *name, unsigned int hash) {
+    fs_dir *d = dir->dir;
+    dir_load(dir);
+    if (d->entry_slots == 0) {
+        return NULL;
+    }
+    unsigned int mask = d->entry_slots - 1;
+    for (unsigned int i = hash & mask;; i = (i + 1) & mask) {
+        fs_node *entry = d->entries[i];
+        if (entry == NULL) {
+            return NULL;
+        }
+        if (entry != ENTRY_DELETED && entry->name_hash == hash &&
+            kstreq(entry->name, name)) {
+            return entry;
         }
-        current = current->next;
     }
-    return NULL;
 }
 
-int fs_mkdir(const char *path) {
-    if (kstrlen(path) == 0 || kstrlen(path) >= MAX_FILENAME_LEN) {
-        return -1; // Invalid path
+fs_node *fs_dir_lookup(fs_node *dir, const char *name) {
+    fs_lock();
+    fs_node *result = dir_lookup(dir, name, fs_name_hash(name));
+    fs_unlock();
+    return result;
+}
+
+// Linear probing into the first free slot; 1 if that held a tombstone
+static int table_place(fs_node **entries, unsigned int slots, fs_node *node) {
+    unsigned int mask = slots - 1;
+    unsigned int i = node->name_hash & mask;
+    while (entries[i] != NULL && entries[i] != ENTRY_DELETED) {
+        i = (i + 1) & mask;
     }
-    
-    // Check if directory already exists
-    if (fs_find_dir(path) != NULL) {
-        vga_puts("Directory already exists: ");
-        vga_puts(path);
-        vga_puts("\n");
+    int reused = entries[i] == ENTRY_DELETED;
+    entries[i] = node;
+    node->slot = i;
+    return reused;
+}
+
+// Rebuild the table at a new size, dropping tombstones
+static int table_resize(fs_dir *dir, unsigned int slots) {
+    fs_node **entries = kzalloc(slots * sizeof(fs_node *));
+    if (entries == NULL) {
         return -1;
     }
-    
-    // Create new directory
-    fs_node *new_dir = fs_create_node(path, TYPE_DIRECTORY);
-    if (new_dir == NULL) {
-        vga_puts("Cannot create directory: filesystem full\n");
-        return -1;
+    for (fs_node *child = dir->children; child != NULL; child = child->next) {
+        table_place(entries, slots, child);
     }
-    
-    // Add to current directory's children
-    new_dir->next = current_dir->children;
-    current_dir->children = new_dir;
-    
-    vga_puts("Created directory: ");
-    vga_puts(path);
-    vga_puts("\n");
+    kfree(dir->entries);
+    dir->entries = entries;
+    dir->entry_slots = slots;
+    dir->entry_deleted = 0;
     return 0;
 }
 
-int fs_touch(const char *filename) {
-    if (kstrlen(filename) == 0 || kstrlen(filename) >= MAX_FILENAME_LEN) {
-        return -1; // Invalid filename
+// Add node to dir's table and child list. The table is kept at most
+// three quarters full, counting tombstones, so probes stay short.
+static int dir_link_locked(fs_node *dir, fs_node *node) {
+    fs_dir *d = dir->dir;
+    unsigned int used = d->entry_count + d->entry_deleted + 1;
+    if (used * 4 > d->entry_slots * 3) {
+        unsigned int slots = d->entry_slots == 0 ? FS_DIR_INITIAL_SLOTS
+                                                 : d->entry_slots;
+        // Mostly tombstones: a rehash at the same size is enough
+        while ((d->entry_count + 1) * 2 > slots) {
+            slots *= 2;
+        }
+        if (table_resize(d, slots) != 0) {
+            return -1;
+        }
+    }
+    if (table_place(d->entries, d->entry_slots, node)) {
+        d->entry_deleted--;
+    }
+    d->entry_count++;
+    dcache_invalidate(dir, node->name, node->name_hash);  // May be negative
+
+    node->parent = dir;
+    node->prev = NULL;
+    node->next = d->children;
+    if (d->children != NULL) {
+        d->children->prev = node;
+    }
+    d->children = node;
+    return 0;
+}
+
+int fs_dir_link(fs_node *dir, fs_node *node) {
+    fs_lock();
+    int result = dir_link_locked(dir, node);
+    fs_unlock();
+    return result;
+}
+
+// One step of a path walk; names come from the dentry cache when they
+// can, and every answer from the tables, found or not, is cached
+static fs_node *walk_step(fs_node *dir, const char *name) {
+    if (kstreq(name, ".")) {
+        return dir;
+    }
+    if (kstreq(name, "..")) {
+        return dir->parent != NULL ? dir->parent : dir;
+    }
+    unsigned int hash = fs_name_hash(name);
+    fs_node *node;
+    if (!dcache_lookup(dir, name, hash, &node)) {
+        node = dir_lookup(dir, name, hash);
+        dcache_insert(dir, name, hash, node);
+    }
+    return node;
+}
+
+// Walk an absolute or relative path. With leaf set, the last component
+// is not looked up but copied to leaf, and its directory is returned.
+// NULL if a component is missing, too long, or not a directory.
+static fs_node *walk(const char *path, char *leaf) {
+    fs_node *node = path[0] == '/' ? &root_dir : current_dir;
+    char name[MAX_FILENAME_LEN];
+
+    while (1) {
+        while (*path == '/') path++;
+        if (*path == '\0') {
+            return leaf == NULL ? node : NULL;
+        }
+        int len = 0;
+        while (path[len] && path[len] != '/') {
+            if (len == MAX_FILENAME_LEN - 1) {
+                return NULL;
+            }
+            name[len] = path[len];
+            len++;
+        }
+        name[len] = '\0';
+        path += len;
+
+        if (node->type != TYPE_DIRECTORY) {
+            return NULL;
+        }
+        const char *rest = path;
+        while (*rest == '/') rest++;
+        if (leaf != NULL && *rest == '\0') {
+            if (kstreq(name, ".") || kstreq(name, "..")) {
+                return NULL;
+            }
+            kstrcpy(leaf, name);
+            return node;
+        }
+        node = walk_step(node, name);
+        if (node == NULL) {
+            return NULL;
+        }
+    }
+}
+
+fs_node *fs_lookup(const char *path) {
+    fs_lock();
+    fs_node *result = walk(path, NULL);
+    fs_unlock();
+    return result;
+}
+
+fs_node *fs_lookup_parent(const char *path, char *leaf) {
+    fs_lock();
+    fs_node *result = walk(path, leaf);
+    fs_unlock();
+    return result;
+}
+
+static fs_node *find_file_locked(const char *path) {
+    fs_node *node = walk(path, NULL);
+    return node != NULL && node->type == TYPE_FILE ? node : NULL;
+}
+
+fs_node *fs_find_file(const char *path) {
+    fs_lock();
+    fs_node *result = find_file_locked(path);
+    fs_unlock();
+    return result;
+}
+
+static fs_node *fs_find_dir(const char *path) {
+    fs_node *node = walk(path, NULL);
+    return node != NULL && node->type == TYPE_DIRECTORY ? node : NULL;
+}
+
+// Full path of a directory, built once from its parent's and kept; nodes
+// are never renamed or moved, so it stays valid until the node goes
+static const char *node_path_locked(fs_node *dir) {
+    if (dir == &root_dir) {
+        return "/";
+    }
+    if (dir->dir->path == NULL) {
+        const char *parent = fs_node_path(dir->parent);
+        if (parent == NULL) {
+            return NULL;
+        }
+        unsigned int parent_len = parent[1] == '\0' ? 0 : kstrlen(parent);
+        unsigned int size = parent_len + 1 + kstrlen(dir->name) + 1;
+        char *path = kmalloc(size);
+        if (path == NULL) {
+            return NULL;
+        }
+        strbuf sb;
+        sb_init(&sb, path, size);
+        sb_append_n(&sb, parent, parent_len);
+        sb_append_char(&sb, '/');
+        sb_append(&sb, dir->name);
+        dir->dir->path = path;
+    }
+    return dir->dir->path;
+}
+
+const char *fs_node_path(fs_node *dir) {
+    fs_lock();
+    const char *result = node_path_locked(dir);
+    fs_unlock();
+    return result;
+}
+
+// Link a new node into dir, and into its directory on disk if it has one
+static fs_node *create_in(fs_node *dir, const char *name, fs_node_type type) {
+    fs_node *node = node_create(name, type);
+    if (node == NULL) {
+        return NULL;
+    }
+    if (dir->ino != 0) {
+        node->ino = diskfs_create(dir->ino, name, type);
+        if (node->ino == 0) {
+            node_destroy(node);
+            return NULL;
+        }
+    }
+    if (fs_dir_link(dir, node) != 0) {
+        if (node->ino != 0) {
+            diskfs_unlink(dir->ino, name);
+        }
+        node_destroy(node);
+        return NULL;
+    }
+    return node;
+}
+
+// Create a node at path; its directory must exist and the name be free
+static fs_node *create(const char *path, fs_node_type type, const char *what) {
+    char name[MAX_FILENAME_LEN];
+    fs_node *dir = path != NULL ? walk(path, name) : NULL;
+    if (dir == NULL) {
+        kprintf("Invalid path: %s\n", path != NULL ? path : "");
+        return NULL;
+    }
+    if (dir_lookup(dir, name, fs_name_hash(name)) != NULL) {
+        kprintf("Already exists: %s\n", path);
+        return NULL;
     }
     
-    // Check if file already exists
-    if (fs_find_file(filename) != NULL) {
-        vga_puts("File already exists: ");
-        vga_puts(filename);
-        vga_puts("\n");
+    fs_node *node = create_in(dir, name, type);
+    if (node == NULL) {
+        kprintf("Cannot create %s: out of %s\n", what,
+                dir->ino != 0 ? "disk space" : "memory");
+    }
+    return node;
+}
+
+static fs_node *create_locked(const char *path, fs_node_type type) {
+    char name[MAX_FILENAME_LEN];
+    fs_node *dir = walk(path, name);
+    if (dir == NULL || dir_lookup(dir, name, fs_name_hash(name)) != NULL) {
+        return NULL;
+    }
+    return create_in(dir, name, type);
+}
+
+fs_node *fs_create(const char *path, fs_node_type type) {
+    fs_lock();
+    fs_node *result = create_locked(path, type);
+    fs_unlock();
+    return result;
+}
+
+static int mkdir_locked(const char *path) {
+    if (create(path, TYPE_DIRECTORY, "directory") == NULL) {
         return -1;
     }
-    
-    // Create new file
-    fs_node *new_file = fs_create_node(filename, TYPE_FILE);
-    if (new_file == NULL) {
-        vga_puts("Cannot create file: filesystem full\n");
+    kprintf("Created directory: %s\n", path);
+    return 0;
+}
+
+int fs_mkdir(const char *path) {
+    fs_lock();
+    int result = mkdir_locked(path);
+    fs_unlock();
+    return result;
+}
+
+static int touch_locked(const char *path) {
+    if (create(path, TYPE_FILE, "file") == NULL) {
         return -1;
     }
-    
-    // Add to current directory's children
-    new_file->next = current_dir->children;
-    current_dir->children = new_file;
-    
-    vga_puts("Created file: ");
-    vga_puts(filename);
-    vga_puts("\n");
+    kprintf("Created file: %s\n", path);
     return 0;
 }
 
-int fs_write(const char *filename, const char *content) {
+int fs_touch(const char *path) {
+    fs_lock();
+    int result = touch_locked(path);
+    fs_unlock();
+    return result;
+}
+
+// Make room for extent index in the extent map. The map doubles, so a
+// file grown by appends re-copies it O(log n) times in total.
+static int extent_map_reserve(fs_node *file, unsigned int index) {
+    if (index < file->extent_slots) {
+        return 0;
+    }
+    unsigned int slots = file->extent_slots ? file->extent_slots : 1;
+    while (slots <= index) {
+        slots *= 2;
+    }
+    char **extents = kzalloc(slots * sizeof(char *));
+    if (extents == NULL) {
+        return -1;
+    }
+    kmemcpy(extents, file->extents, file->extent_slots * sizeof(char *));
+    kfree(file->extents);
+    file->extents = extents;
+    file->extent_slots = slots;
+    return 0;
+}
+
+// Extent index of a file in RAM; NULL for a hole
+static char *extent_get(fs_node *file, unsigned int index) {
+    return index < file->extent_slots ? file->extents[index] : NULL;
+}
+
+// Files on disk keep no extents: their blocks are read and written in
+// place in the buffer cache, so the data is cached once and evictable
+static int file_write_locked(fs_node *file, size_t offset, const void *buf, size_t len) {
+    const char *src = buf;
+    size_t done = 0;
+    size_t old_size = file->size;
+    if (offset + len < offset) {
+        return -1; // Past the largest size we can represent
+    }
+
+    while (done < len) {
+        size_t pos = offset + done;
+        unsigned int index = pos / FS_EXTENT_SIZE;
+        size_t within = pos % FS_EXTENT_SIZE;
+        size_t chunk = FS_EXTENT_SIZE - within;
+        if (chunk > len - done) chunk = len - done;
+
+        if (file->ino != 0) {
+            bcache_buf *b = diskfs_block(file->ino, index, 1);
+            if (b == NULL) {
+                break;
+            }
+            kmemcpy(b->data + within, src + done, chunk);
+            bcache_dirty(b);
+            bcache_release(b);
+            done += chunk;
+            if (offset + done > file->size) {
+                file->size = offset + done;
+            }
+            continue;
+        }
+
+        if (extent_map_reserve(file, index) != 0) {
+            break;
+        }
+        char *extent = extent_get(file, index);
+        if (extent == NULL) {
+            extent = kmalloc(FS_EXTENT_SIZE);
+            if (extent == NULL) {
+                break;
+            }
+            // Only the part this write doesn't cover has to be cleared
+            kmemset(extent, 0, within);
+            kmemset(extent + within + chunk, 0, FS_EXTENT_SIZE - within - chunk);
+            file->extents[index] = extent;
+        }
+        kmemcpy(extent + within, src + done, chunk);
+        done += chunk;
+        if (offset + done > file->size) {
+            file->size = offset + done;
+        }
+    }
+    if (file->ino != 0 && file->size != old_size) {
+        diskfs_set_size(file->ino, file->size);
+    }
+    // Out of memory or disk part way: report the bytes that did land
+    return done == 0 && len > 0 ? -1 : (int)done;
+}
+
+int fs_file_write(fs_node *file, size_t offset, const void *buf, size_t len) {
+    fs_lock();
+    int result = file_write_locked(file, offset, buf, len);
+    fs_unlock();
+    return result;
+}
+
+static const char *file_view_locked(fs_node *file, size_t offset, size_t *len,
+                                    bcache_buf **held) {
+    *held = NULL;
+    if (offset >= file->size) {
+        *len = 0;
+        return NULL;
+    }
+    unsigned int index = offset / FS_EXTENT_SIZE;
+    size_t within = offset % FS_EXTENT_SIZE;
+    *len = FS_EXTENT_SIZE - within;
+    if (*len > file->size - offset) {
+        *len = file->size - offset;
+    }
+    if (file->ino != 0) {
+        *held = diskfs_block(file->ino, index, 0);
+        return *held != NULL ? (const char *)(*held)->data + within : NULL;
+    }
+    char *extent = extent_get(file, index);
+    return extent != NULL ? extent + within : NULL;
+}
+
+const char *fs_file_view(fs_node *file, size_t offset, size_t *len,
+                         bcache_buf **held) {
+    fs_lock();
+    const char *result = file_view_locked(file, offset, len, held);
+    fs_unlock();
+    return result;
+}
+
+static int file_read_locked(fs_node *file, size_t offset, void *buf, size_t len) {
+    char *dst = buf;
+    size_t done = 0;
+    while (done < len) {
+        size_t chunk;
+        bcache_buf *held;
+        const char *src = fs_file_view(file, offset + done, &chunk, &held);
+        if (chunk == 0) {
+            break; // End of file
+        }
+        if (chunk > len - done) chunk = len - done;
+        if (src != NULL) {
+            kmemcpy(dst + done, src, chunk);
+        } else {
+            kmemset(dst + done, 0, chunk);
+        }
+        if (held != NULL) {
+            bcache_release(held);
+        }
+        done += chunk;
+    }
+    return done;
+}
+
+int fs_file_read(fs_node *file, size_t offset, void *buf, size_t len) {
+    fs_lock();
+    int result = file_read_locked(file, offset, buf, len);
+    fs_unlock();
+    return result;
+}
+
+// Shrinking frees whole extents past the end and clears the tail of the
+// last one, so growing again later reads zeros; growing leaves a hole
+static int file_truncate_locked(fs_node *file, size_t size) {
+    if (size < file->size) {
+        unsigned int keep = (size + FS_EXTENT_SIZE - 1) / FS_EXTENT_SIZE;
+        size_t within = size % FS_EXTENT_SIZE;
+        if (within != 0 && file->ino != 0) {
+            bcache_buf *b = diskfs_block(file->ino, keep - 1, 0);
+            if (b != NULL) {
+                kmemset(b->data + within, 0, FS_EXTENT_SIZE - within);
+                bcache_dirty(b);
+                bcache_release(b);
+            }
+        } else if (within != 0) {
+            // The map can be shorter than the file after a grow by
+            // truncate or a hole past its end; then there is no tail
+            char *last = extent_get(file, keep - 1);
+            if (last != NULL) {
+                kmemset(last + within, 0, FS_EXTENT_SIZE - within);
+            }
+        }
+        for (unsigned int i = keep; i < file->extent_slots; i++) {
+            kfree(file->extents[i]);
+            file->extents[i] = NULL;
+        }
+        if (keep == 0) {
+            extents_free(file);
+        }
+    }
+    file->size = size;
+    if (file->ino != 0) {
+        return diskfs_set_size(file->ino, size);
+    }
+    return 0;
+}
+
+int fs_file_truncate(fs_node *file, size_t size) {
+    fs_lock();
+    int result = file_truncate_locked(file, size);
+    fs_unlock();
+    return result;
+}
+
+// Replace a file's contents with a private copy of data. Extents already
+// allocated are overwritten in place.
+static int set_data_locked(fs_node *file, const char *data, size_t size) {
+    if (size > 0 && fs_file_write(file, 0, data, size) != (int)size) {
+        return -1;
+    }
+    return fs_file_truncate(file, size);
+}
+
+int fs_set_data(fs_node *file, const char *data, size_t size) {
+    fs_lock();
+    int result = set_data_locked(file, data, size);
+    fs_unlock();
+    return result;
+}
+
+static int write_locked(const char *filename, const char *content) {
     fs_node *file = fs_find_file(filename);
     if (file == NULL) {
-        vga_puts("File not found: ");
-        vga_puts(filename);
-        vga_puts("\n");
+        kprintf("File not found: %s\n", filename);
         return -1;
     }
     
-    // For simplicity, we'll just store the content pointer
-    // In a real OS, we'd copy the content to allocated memory
-    file->data = (char*)content;
-    file->size = kstrlen(content);
+    // The caller's buffer is usually on its stack, so keep our own copy
+    if (fs_set_data(file, content, kstrlen(content)) != 0) {
+        vga_puts("Cannot write file: out of memory\n");
+        return -1;
+    }
     
-    vga_puts("Written to ");
-    vga_puts(filename);
-    vga_puts("\n");
+    kprintf("Written to %s\n", filename);
     return 0;
 }
 
-int fs_cat(const char *filename) {
+int fs_write(const char *filename, const char *content) {
+    fs_lock();
+    int result = write_locked(filename, content);
+    fs_unlock();
+    return result;
+}
+
+static int cat_locked(const char *filename) {
     fs_node *file = fs_find_file(filename);
     if (file == NULL) {
-        vga_puts("File not found: ");
-        vga_puts(filename);
-        vga_puts("\n");
+        kprintf("File not found: %s\n", filename);
         return -1;
     }
     
-    if (file->size == 0 || file->data == NULL) {
-        vga_puts("File is empty: ");
-        vga_puts(filename);
-        vga_puts("\n");
+    if (file->size == 0) {
+        kprintf("File is empty: %s\n", filename);
         return 0;
     }
     
-    vga_puts("Contents of ");
-    vga_puts(filename);
-    vga_puts(":\n");
+    kprintf("Contents of %s:\n", filename);
     
-    // Display file content
-    for (unsigned int i = 0; i < file->size; i++) {
-        vga_putc(file->data[i]);
+    // Straight from the extents, one console write per extent
+    static const char zeros[64];
+    size_t offset = 0;
+    while (offset < file->size) {
+        size_t len;
+        bcache_buf *held;
+        const char *data = fs_file_view(file, offset, &len, &held);
+        if (data == NULL && len > sizeof(zeros)) {
+            len = sizeof(zeros);
+        }
+        vga_write(data != NULL ? data : zeros, len);
+        if (held != NULL) {
+            bcache_release(held);
+        }
+        offset += len;
     }
     vga_puts("\n");
     
     return 0;
 }
 
-int fs_ls(const char *path) {
-    // If path is provided, we'd need to navigate to it
-    // For simplicity, just list current directory
-    if (path != NULL && kstrlen(path) > 0) {
-        vga_puts("ls with path not implemented yet\n");
-        return -1;
+int fs_cat(const char *filename) {
+    fs_lock();
+    int result = cat_locked(filename);
+    fs_unlock();
+    return result;
+}
+
+static int ls_locked(const char *path) {
+    fs_node *dir = current_dir;
+    if (path != NULL && path[0] != '\0') {
+        dir = fs_find_dir(path);
+        if (dir == NULL) {
+            kprintf("Directory not found: %s\n", path);
+            return -1;
+        }
     }
     
-    vga_puts("Contents of ");
-    if (current_dir == &root_dir) {
-        vga_puts("/");
-    } else {
-        vga_puts(current_dir->name);
-    }
-    vga_puts(":\n");
+    const char *full = fs_node_path(dir);
+    kprintf("Contents of %s:\n", full != NULL ? full : dir->name);
     
-    fs_node *current = current_dir->children;
+    dir_load(dir);
+    fs_node *current = dir->dir->children;
     int count = 0;
     
     while (current != NULL) {
-        vga_puts("  ");
         if (current->type == TYPE_DIRECTORY) {
-            vga_puts("[DIR]  ");
+            vga_write("  [DIR]  ", 9);
+            vga_write_attr(current->name, kstrlen(current->name), LS_DIR_ATTR);
         } else {
-            vga_puts("[FILE] ");
+            vga_write("  [FILE] ", 9);
+            vga_write(current->name, kstrlen(current->name));
         }
-        vga_puts(current->name);
-        vga_puts("\n");
+        vga_write("\n", 1);
         current = current->next;
         count++;
     }
@@ -211,150 +922,185 @@ int fs_ls(const char *path) {
     return 0;
 }
 
-int fs_pwd(void) {
-    vga_puts("Current directory: ");
-    
-    // Build path by traversing up the tree
-    char path[MAX_PATH_LEN] = "";
-    fs_node *node = current_dir;
-    
-    while (node != NULL && node != &root_dir) {
-        char temp[MAX_PATH_LEN];
-        kstrcpy(temp, path);
-        kstrcpy(path, "/");
-        kstrcat(path, node->name);
-        kstrcat(path, temp);
-        node = node->parent;
-    }
-    
-    if (kstrlen(path) == 0) {
-        kstrcpy(path, "/");
+int fs_ls(const char *path) {
+    fs_lock();
+    int result = ls_locked(path);
+    fs_unlock();
+    return result;
+}
+
+static int pwd_locked(void) {
+    const char *path = fs_node_path(current_dir);
+    if (path == NULL) {
+        vga_puts("pwd: out of memory\n");
+        return -1;
     }
-    
-    vga_puts(path);
-    vga_puts("\n");
+    kprintf("Current directory: %s\n", path);
     return 0;
 }
 
-int fs_cd(const char *path) {
-    if (path == NULL || kstrlen(path) == 0) {
+int fs_pwd(void) {
+    fs_lock();
+    int result = pwd_locked();
+    fs_unlock();
+    return result;
+}
+
+static int cd_locked(const char *path) {
+    if (path == NULL || path[0] == '\0') {
         // cd to home (root)
         current_dir = &root_dir;
         return 0;
     }
     
-    if (kstreq(path, "..")) {
-        // Move to parent directory
-        if (current_dir->parent != NULL) {
-            current_dir = current_dir->parent;
-        }
-        return 0;
-    }
-    
-    if (kstreq(path, ".")) {
-        // Stay in current directory
-        return 0;
-    }
-    
-    if (kstreq(path, "/")) {
-        // cd to root
-        current_dir = &root_dir;
-        return 0;
-    }
-    
-    // Look for directory in current directory
     fs_node *dir = fs_find_dir(path);
     if (dir != NULL) {
         current_dir = dir;
         return 0;
     }
     
-    vga_puts("Directory not found: ");
-    vga_puts(path);
-    vga_puts("\n");
+    kprintf("Directory not found: %s\n", path);
     return -1;
 }
 
-// Helper function to remove a node from its parent's children list
-int fs_remove_node(fs_node *node) {
+int fs_cd(const char *path) {
+    fs_lock();
+    int result = cd_locked(path);
+    fs_unlock();
+    return result;
+}
+
+// Unlink a node from its parent in O(1): its table slot becomes a
+// tombstone and the sibling list is doubly linked. The node is left
+// without a parent, for the caller to free.
+static int remove_node_locked(fs_node *node) {
     if (node == NULL || node->parent == NULL) {
         return -1;
     }
-    
-    // Special case: node is the first child
-    if (node->parent->children == node) {
-        node->parent->children = node->next;
-        return 0;
+    fs_dir *dir = node->parent->dir;
+    if (node->slot >= dir->entry_slots || dir->entries[node->slot] != node) {
+        return -1; // Not linked into its parent
     }
     
-    // Find the node in the children list
-    fs_node *current = node->parent->children;
-    while (current != NULL && current->next != node) {
-        current = current->next;
-    }
+    dir->entries[node->slot] = ENTRY_DELETED;
+    dir->entry_count--;
+    dir->entry_deleted++;
     
-    if (current != NULL) {
-        current->next = node->next;
-        return 0;
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        dir->children = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
     }
+    node->next = NULL;
+    node->prev = NULL;
     
-    return -1; // Node not found in parent's children
+    dcache_invalidate(node->parent, node->name, node->name_hash);
+    if (node->type == TYPE_DIRECTORY) {
+        dcache_purge_dir(node);
+    }
+    node->parent = NULL;
+    return 0;
 }
 
-int fs_rm(const char *path) {
+int fs_remove_node(fs_node *node) {
+    fs_lock();
+    int result = remove_node_locked(node);
+    fs_unlock();
+    return result;
+}
+
+// Take node out of its directory, on disk first so that a failure there
+// leaves it where it was
+static int unlink_node(fs_node *node) {
+    if (node->ino != 0 && node->parent != NULL &&
+        diskfs_unlink(node->parent->ino, node->name) != 0) {
+        kprintf("Cannot remove %s: disk error\n", node->name);
+        return -1;
+    }
+    return fs_remove_node(node);
+}
+
+static int rm_locked(const char *path) {
     if (path == NULL || kstrlen(path) == 0) {
         vga_puts("Usage: rm <file_or_directory>\n");
         return -1;
     }
     
-    // Check if it's a file
-    fs_node *file = fs_find_file(path);
-    if (file != NULL) {
-        if (fs_remove_node(file) == 0) {
-            vga_puts("Removed file: ");
-            vga_puts(path);
-            vga_puts("\n");
-            return 0;
-        }
+    fs_node *node = fs_lookup(path);
+    if (node == NULL) {
+        kprintf("File or directory not found: %s\n", path);
+        return -1;
     }
     
-    // Check if it's a directory
-    fs_node *dir = fs_find_dir(path);
-    if (dir != NULL) {
-        // Check if directory is empty
-        if (dir->children != NULL) {
-            vga_puts("Cannot remove directory: ");
-            vga_puts(path);
-            vga_puts(" is not empty\n");
-            return -1;
-        }
-        
-        // Don't allow removing current directory
-        if (dir == current_dir) {
-            vga_puts("Cannot remove current directory\n");
-            return -1;
-        }
-        
-        // Don't allow removing root directory
-        if (dir == &root_dir) {
-            vga_puts("Cannot remove root directory\n");
+    if (node->type == TYPE_FILE) {
+        if (unlink_node(node) != 0) {
             return -1;
         }
-        
-        if (fs_remove_node(dir) == 0) {
-            vga_puts("Removed directory: ");
-            vga_puts(path);
-            vga_puts("\n");
-            return 0;
+        if (node->open_count == 0) {
+            node_destroy(node); // Otherwise the last fs_close frees it
         }
+        kprintf("Removed file: %s\n", path);
+        return 0;
     }
     
-    vga_puts("File or directory not found: ");
-    vga_puts(path);
-    vga_puts("\n");
-    return -1;
+    // Don't allow removing root directory
+    if (node == &root_dir) {
+        vga_puts("Cannot remove root directory\n");
+        return -1;
+    }
+    
+    // Check if directory is empty
+    dir_load(node);
+    if (node->dir->children != NULL) {
+        kprintf("Cannot remove directory: %s is not empty\n", path);
+        return -1;
+    }
+    
+    // Don't allow removing current directory
+    if (node == current_dir) {
+        vga_puts("Cannot remove current directory\n");
+        return -1;
+    }
+    
+    if (unlink_node(node) != 0) {
+        return -1;
+    }
+    node_destroy(node);
+    kprintf("Removed directory: %s\n", path);
+    return 0;
+}
+
+int fs_rm(const char *path) {
+    fs_lock();
+    int result = rm_locked(path);
+    fs_unlock();
+    return result;
+}
+
+void fs_node_hold(fs_node *node) {
+    fs_lock();
+    node->open_count++;
+    fs_unlock();
+}
+
+static void node_release_locked(fs_node *node) {
+    if (--node->open_count == 0 && node->parent == NULL && node != &root_dir) {
+        node_destroy(node);
+    }
+}
+
+void fs_node_release(fs_node *node) {
+    fs_lock();
+    node_release_locked(node);
+    fs_unlock();
 }
 
 fs_node *fs_get_current_dir(void) {
-    return current_dir;
+    fs_lock();
+    fs_node *result = current_dir;
+    fs_unlock();
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+// cpuid.c
+#include "cpuid.h"
+
+cpu_feature_set cpu_features;
+
+// regs receives eax, ebx, ecx, edx in that order
+void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+    asm volatile ("cpuid"
+                  : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3])
+                  : "a"(leaf), "c"(subleaf));
+}
+
+// Every CPU that can boot this kernel (i686 and up) has CPUID, so the
+// EFLAGS.ID probe is skipped.
+void cpuid_init(void) {
+    unsigned int r[4];
+
+    cpuid(0, 0, r);
+    cpu_features.max_leaf = r[0];
+    // The vendor string is spread over ebx, edx, ecx
+    unsigned int order[3] = {r[1], r[3], r[2]};
+    for (int i = 0; i < 12; i++) {
+        cpu_features.vendor[i] = (order[i / 4] >> ((i % 4) * 8)) & 0xFF;
+    }
+    cpu_features.vendor[12] = '\0';
+
+    if (cpu_features.max_leaf >= 1) {
+        cpuid(1, 0, r);
+        cpu_features.fpu = (r[3] >> 0) & 1;
+        cpu_features.fxsr = (r[3] >> 24) & 1;
+        cpu_features.sse = (r[3] >> 25) & 1;
+        cpu_features.sse2 = (r[3] >> 26) & 1;
+        cpu_features.sse3 = (r[2] >> 0) & 1;
+        cpu_features.ssse3 = (r[2] >> 9) & 1;
+        cpu_features.sse41 = (r[2] >> 19) & 1;
+        cpu_features.sse42 = (r[2] >> 20) & 1;
+        cpu_features.xsave = (r[2] >> 26) & 1;
+        cpu_features.avx = (r[2] >> 28) & 1;
+    }
+
+    if (cpu_features.max_leaf >= 7) {
+        cpuid(7, 0, r);
+        cpu_features.avx2 = (r[1] >> 5) & 1;
+        cpu_features.erms = (r[1] >> 9) & 1;
+    }
+}
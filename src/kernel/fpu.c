@@ -0,0 +1,212 @@
+// fpu.c
+#include "fpu.h"
+#include "cpuid.h"
+#include "sched.h"
+#include "heap.h"
+#include "idt.h"
+#include "vga.h"
+#include "serial.h"
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+#define CR4_OSXSAVE (1 << 18)
+
+#define XCR0_X87 0x1
+#define XCR0_SSE 0x2
+#define XCR0_AVX 0x4
+
+#define FPU_VECTOR 7          // #NM, device not available
+#define FPU_DEFAULT_FCW 0x037F  // All x87 exceptions masked
+#define FPU_DEFAULT_MXCSR 0x1F80  // All SSE exceptions masked
+
+typedef enum {
+    FPU_NONE,
+    FPU_FNSAVE,
+    FPU_FXSAVE,
+    FPU_XSAVE
+} fpu_format;
+
+static fpu_format format = FPU_NONE;
+static unsigned int xcr0 = 0;
+static unsigned int state_size = 0;
+
+static inline unsigned int read_cr0(void) {
+    unsigned int v;
+    asm volatile ("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(unsigned int v) {
+    asm volatile ("mov %0, %%cr0" : : "r"(v));
+}
+
+static void fpu_save(void *state) {
+    switch (format) {
+    case FPU_XSAVE:
+        asm volatile ("xsave (%0)" : : "r"(state), "a"(xcr0), "d"(0) : "memory");
+        break;
+    case FPU_FXSAVE:
+        asm volatile ("fxsave (%0)" : : "r"(state) : "memory");
+        break;
+    case FPU_FNSAVE:
+        asm volatile ("fnsave (%0)" : : "r"(state) : "memory");
+        break;
+    default:
+        break;
+    }
+}
+
+static void fpu_restore(void *state) {
+    switch (format) {
+    case FPU_XSAVE:
+        asm volatile ("xrstor (%0)" : : "r"(state), "a"(xcr0), "d"(0) : "memory");
+        break;
+    case FPU_FXSAVE:
+        asm volatile ("fxrstor (%0)" : : "r"(state) : "memory");
+        break;
+    case FPU_FNSAVE:
+        asm volatile ("frstor (%0)" : : "r"(state) : "memory");
+        break;
+    default:
+        break;
+    }
+}
+
+// #NM: the current thread wants the FPU. Its registers may still be live
+// on this CPU if nobody else used the FPU since it last did.
+static void fpu_trap(interrupt_frame *frame) {
+    (void)frame;
+    if (format == FPU_NONE) {
+        vga_puts("\nFPU instruction executed but no FPU is present\n");
+        vga_puts("System halted.\n");
+        vga_flush();
+        serial_flush();
+        asm volatile ("cli");
+        while (1) asm volatile ("hlt");
+    }
+
+    asm volatile ("clts");
+    cpu *c = this_cpu();
+    thread *t = c->current;
+    if (t == 0) {
+        return; // Before sched_init there is only one context
+    }
+    if (c->fpu_owner != t || t->fpu_cpu != c->index) {
+        fpu_restore(t->fpu_state);
+        c->fpu_owner = t;
+        t->fpu_cpu = c->index;
+    }
+}
+
+void fpu_init_cpu(void) {
+    unsigned int cr0 = read_cr0();
+    if (format == FPU_NONE) {
+        write_cr0(cr0 | CR0_EM); // Trap, so the first use is reported
+        return;
+    }
+    write_cr0((cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    asm volatile ("fninit");
+
+    if (format >= FPU_FXSAVE) {
+        unsigned int cr4;
+        asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+        if (format == FPU_XSAVE) {
+            cr4 |= CR4_OSXSAVE;
+        }
+        asm volatile ("mov %0, %%cr4" : : "r"(cr4));
+    }
+    if (format == FPU_XSAVE) {
+        asm volatile ("xsetbv" : : "c"(0), "a"(xcr0), "d"(0));
+    }
+
+    // Nobody owns the registers yet; the first user traps
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+void fpu_init(void) {
+    if (cpu_features.xsave && cpu_features.fxsr && cpu_features.sse) {
+        format = FPU_XSAVE;
+        xcr0 = XCR0_X87 | XCR0_SSE;
+        if (cpu_features.avx) {
+            xcr0 |= XCR0_AVX;
+        }
+    } else if (cpu_features.fxsr && cpu_features.sse) {
+        format = FPU_FXSAVE;
+        state_size = 512;
+    } else if (cpu_features.fpu) {
+        format = FPU_FNSAVE;
+        state_size = 108;
+    }
+
+    isr_register(FPU_VECTOR, fpu_trap);
+    fpu_init_cpu();
+
+    if (format == FPU_XSAVE) {
+        // EBX reports the area size for the features enabled in XCR0
+        unsigned int r[4];
+        cpuid(0xD, 0, r);
+        state_size = r[1];
+    }
+}
+
+int fpu_state_alloc(thread *t) {
+    t->fpu_cpu = -1;
+    if (format == FPU_NONE) {
+        return 0;
+    }
+
+    // xsave needs 64-byte alignment, fxsave 16; slab objects only give 16
+    t->fpu_area = kzalloc(state_size + 63);
+    if (t->fpu_area == 0) {
+        return -1;
+    }
+    unsigned char *state = (unsigned char *)
+        (((unsigned int)t->fpu_area + 63) & ~63);
+    t->fpu_state = state;
+
+    // Both layouts start with FCW; fxsave/xsave keep MXCSR at offset 24.
+    // A zeroed xsave header marks every component as in its init state.
+    *(unsigned short *)state = FPU_DEFAULT_FCW;
+    if (format == FPU_FNSAVE) {
+        *(unsigned short *)(state + 8) = 0xFFFF; // Tag word: all empty
+    } else {
+        *(unsigned int *)(state + 24) = FPU_DEFAULT_MXCSR;
+    }
+    return 0;
+}
+
+void fpu_state_free(thread *t) {
+    cpu *c = this_cpu();
+    if (c->fpu_owner == t) {
+        c->fpu_owner = 0;
+    }
+    kfree(t->fpu_area);
+    t->fpu_area = 0;
+    t->fpu_state = 0;
+}
+
+// Called by schedule() with interrupts off. A clear TS means prev touched
+// the FPU during this slice; save eagerly so it can run on any CPU next.
+void fpu_switch_out(thread *prev) {
+    if (format == FPU_NONE) {
+        return;
+    }
+    unsigned int cr0 = read_cr0();
+    if (!(cr0 & CR0_TS)) {
+        fpu_save(prev->fpu_state);
+        write_cr0(cr0 | CR0_TS);
+        if (format == FPU_FNSAVE) {
+            this_cpu()->fpu_owner = 0; // fnsave reinitializes the FPU
+        }
+    }
+}
+
+const char *fpu_save_format(void) {
+    static const char *names[] = {"none", "fnsave", "fxsave", "xsave"};
+    return names[format];
+}
@@ -0,0 +1,70 @@
+// gdt.c
+#include "gdt.h"
+#include "sched.h"
+
+// The bootloader's GDT is not guaranteed to stay valid, so the kernel
+// installs its own flat 4 GB code and data segments, plus one data
+// segment per CPU whose base points at that CPU's per-CPU block.
+typedef struct {
+    unsigned short limit_low;
+    unsigned short base_low;
+    unsigned char base_mid;
+    unsigned char access;
+    unsigned char granularity;
+    unsigned char base_high;
+} __attribute__((packed)) gdt_entry;
+
+typedef struct {
+    unsigned short limit;
+    unsigned int base;
+} __attribute__((packed)) gdt_ptr;
+
+static gdt_entry gdt[GDT_CPU_FIRST + MAX_CPUS];
+static gdt_ptr gdtr;
+
+static void gdt_set_entry(int i, unsigned int base, unsigned int limit,
+                          unsigned char access, unsigned char gran) {
+    gdt[i].limit_low = limit & 0xFFFF;
+    gdt[i].base_low = base & 0xFFFF;
+    gdt[i].base_mid = (base >> 16) & 0xFF;
+    gdt[i].access = access;
+    gdt[i].granularity = ((limit >> 16) & 0x0F) | (gran & 0xF0);
+    gdt[i].base_high = (base >> 24) & 0xFF;
+}
+
+void gdt_set_cpu_base(int cpu, void *base) {
+    gdt_set_entry(GDT_CPU_FIRST + cpu, (unsigned int)base, 0xFFFFF, 0x92, 0xCF);
+}
+
+void gdt_load(int cpu) {
+    unsigned short cpu_selector = (GDT_CPU_FIRST + cpu) * 8;
+
+    // Load the table, then reload CS with a far jump and the data segments
+    asm volatile (
+        "lgdt %0\n\t"
+        "ljmp $0x08, $1f\n"
+        "1:\n\t"
+        "mov $0x10, %%ax\n\t"
+        "mov %%ax, %%ds\n\t"
+        "mov %%ax, %%es\n\t"
+        "mov %%ax, %%fs\n\t"
+        "mov %%ax, %%ss\n\t"
+        "mov %1, %%gs\n\t"
+        : : "m"(gdtr), "r"(cpu_selector) : "eax", "memory");
+}
+
+void gdt_init(void) {
+    gdt_set_entry(0, 0, 0, 0, 0);                // Null descriptor
+    gdt_set_entry(1, 0, 0xFFFFFFFF, 0x9A, 0xCF); // Kernel code
+    gdt_set_entry(2, 0, 0xFFFFFFFF, 0x92, 0xCF); // Kernel data
+    for (int i = 0; i < MAX_CPUS; i++) {
+        // this_cpu() reads the block's self pointer through %gs
+        cpus[i].self = &cpus[i];
+        cpus[i].index = i;
+        gdt_set_cpu_base(i, &cpus[i]);
+    }
+
+    gdtr.limit = sizeof(gdt) - 1;
+    gdtr.base = (unsigned int)&gdt;
+    gdt_load(0);
+}
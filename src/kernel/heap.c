@@ -0,0 +1,201 @@
+// heap.c
+#include "heap.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "kmem.h"
+
+#define SIZE_CLASSES 8   // 16, 32, ... 2048 bytes
+
+// A slab is one or more contiguous frames carved into equal objects. The
+// header sits at the start of the first frame; objects carry no header of
+// their own, their owner is found through page_owner[] instead.
+typedef struct slab {
+    struct slab_cache *cache;
+    struct slab *next;
+    struct slab *prev;
+    void *free_list;          // Singly linked through the free objects
+    unsigned int in_use;
+} slab;
+
+typedef struct slab_cache {
+    unsigned int object_size;
+    unsigned int pages;       // Frames per slab
+    slab *partial;            // Slabs with at least one free object
+} slab_cache;
+
+#define SLAB_HEADER_SIZE ((sizeof(slab) + 15) & ~15)
+
+static slab_cache caches[SIZE_CLASSES];
+static spinlock heap_lock = SPINLOCK_INIT;
+
+// Per-frame owner word: a slab header pointer (bit 0 clear) or, for the
+// first frame of a large allocation, (frame count << 1) | 1.
+static unsigned int *page_owner;
+static unsigned int owner_limit;
+
+static int size_class(unsigned int size) {
+    if (size <= HEAP_MIN_CLASS) {
+        return 0;
+    }
+    // ceil(log2(size)) - log2(HEAP_MIN_CLASS), a single bsr
+    return 32 - __builtin_clz(size - 1) - 4;
+}
+
+void heap_init(void) {
+    owner_limit = pmm_memory_top() >> PAGE_SHIFT;
+    unsigned int table_pages = (owner_limit * 4 + PAGE_SIZE - 1) / PAGE_SIZE;
+    page_owner = (unsigned int *)pmm_alloc_frames(table_pages);
+    if (page_owner == 0) {
+        owner_limit = 0;
+        return;
+    }
+    kmemset(page_owner, 0, owner_limit * sizeof(unsigned int));
+
+    for (int i = 0; i < SIZE_CLASSES; i++) {
+        caches[i].object_size = HEAP_MIN_CLASS << i;
+        // Big objects get 16 KB slabs so the header wastes under one object
+        caches[i].pages = caches[i].object_size >= 1024 ? 4 : 1;
+        caches[i].partial = 0;
+    }
+}
+
+static slab *slab_create(slab_cache *cache) {
+    unsigned int base = pmm_alloc_frames(cache->pages);
+    if (base == 0) {
+        return 0;
+    }
+
+    slab *s = (slab *)base;
+    s->cache = cache;
+    s->next = 0;
+    s->prev = 0;
+    s->in_use = 0;
+
+    // Thread every object onto the free list, lowest address first
+    unsigned int end = base + cache->pages * PAGE_SIZE;
+    unsigned int obj = base + SLAB_HEADER_SIZE;
+    void **link = &s->free_list;
+    while (obj + cache->object_size <= end) {
+        *link = (void *)obj;
+        link = (void **)obj;
+        obj += cache->object_size;
+    }
+    *link = 0;
+
+    for (unsigned int i = 0; i < cache->pages; i++) {
+        page_owner[(base >> PAGE_SHIFT) + i] = (unsigned int)s;
+    }
+    return s;
+}
+
+static void slab_unlink(slab *s) {
+    if (s->prev != 0) {
+        s->prev->next = s->next;
+    } else {
+        s->cache->partial = s->next;
+    }
+    if (s->next != 0) {
+        s->next->prev = s->prev;
+    }
+    s->next = 0;
+    s->prev = 0;
+}
+
+static void slab_push(slab *s) {
+    s->prev = 0;
+    s->next = s->cache->partial;
+    if (s->next != 0) {
+        s->next->prev = s;
+    }
+    s->cache->partial = s;
+}
+
+static void *large_alloc(unsigned int size) {
+    unsigned int pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned int base = pmm_alloc_frames(pages);
+    if (base == 0) {
+        return 0;
+    }
+    page_owner[base >> PAGE_SHIFT] = (pages << 1) | 1;
+    return (void *)base;
+}
+
+void *kmalloc(unsigned int size) {
+    if (size == 0 || owner_limit == 0) {
+        return 0;
+    }
+    if (size > HEAP_MAX_CLASS) {
+        unsigned int flags = spin_lock_irqsave(&heap_lock);
+        void *ptr = large_alloc(size);
+        spin_unlock_irqrestore(&heap_lock, flags);
+        return ptr;
+    }
+
+    slab_cache *cache = &caches[size_class(size)];
+    unsigned int flags = spin_lock_irqsave(&heap_lock);
+
+    slab *s = cache->partial;
+    if (s == 0) {
+        s = slab_create(cache);
+        if (s == 0) {
+            spin_unlock_irqrestore(&heap_lock, flags);
+            return 0;
+        }
+        slab_push(s);
+    }
+
+    void *obj = s->free_list;
+    s->free_list = *(void **)obj;
+    s->in_use++;
+    if (s->free_list == 0) {
+        slab_unlink(s); // Full slabs are only reachable through page_owner
+    }
+
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return obj;
+}
+
+void *kzalloc(unsigned int size) {
+    void *ptr = kmalloc(size);
+    if (ptr != 0) {
+        kmemset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void kfree(void *ptr) {
+    unsigned int frame = (unsigned int)ptr >> PAGE_SHIFT;
+    if (ptr == 0 || frame >= owner_limit) {
+        return;
+    }
+
+    unsigned int flags = spin_lock_irqsave(&heap_lock);
+    unsigned int owner = page_owner[frame];
+
+    if (owner & 1) {
+        page_owner[frame] = 0;
+        pmm_free_frames((unsigned int)ptr, owner >> 1);
+    } else if (owner != 0) {
+        slab *s = (slab *)owner;
+        int was_full = s->free_list == 0;
+
+        *(void **)ptr = s->free_list;
+        s->free_list = ptr;
+        s->in_use--;
+
+        if (was_full) {
+            slab_push(s);
+        }
+        // Give an empty slab back unless it is the cache's last one
+        if (s->in_use == 0 && (s->prev != 0 || s->next != 0)) {
+            unsigned int pages = s->cache->pages;
+            slab_unlink(s);
+            for (unsigned int i = 0; i < pages; i++) {
+                page_owner[((unsigned int)s >> PAGE_SHIFT) + i] = 0;
+            }
+            pmm_free_frames((unsigned int)s, pages);
+        }
+    }
+
+    spin_unlock_irqrestore(&heap_lock, flags);
+}
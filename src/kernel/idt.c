@@ -0,0 +1,146 @@
+// idt.c
+#include "idt.h"
+#include "gdt.h"
+#include "klib.h"
+#include "vga.h"
+#include "sched.h"
+#include "smp.h"
+#include "serial.h"
+#include "kprintf.h"
+
+#define IDT_ENTRIES 256
+
+#define PIC1_CMD 0x20
+#define PIC1_DATA 0x21
+#define PIC2_CMD 0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI 0x20
+
+typedef struct {
+    unsigned short offset_low;
+    unsigned short selector;
+    unsigned char zero;
+    unsigned char type_attr;
+    unsigned short offset_high;
+} __attribute__((packed)) idt_entry;
+
+typedef struct {
+    unsigned short limit;
+    unsigned int base;
+} __attribute__((packed)) idt_ptr;
+
+// Entry points generated in isr.asm, one per vector
+extern unsigned int isr_stub_table[IDT_ENTRIES];
+
+static idt_entry idt[IDT_ENTRIES];
+static idt_ptr idtr;
+static interrupt_handler handlers[IDT_ENTRIES];
+
+static const char *exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow",
+    "Bound range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS",
+    "Segment not present", "Stack-segment fault", "General protection fault",
+    "Page fault", "Reserved", "x87 floating-point error", "Alignment check",
+    "Machine check", "SIMD floating-point error", "Virtualization error",
+    "Control protection error", "Reserved", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Hypervisor injection",
+    "VMM communication", "Security exception", "Reserved"
+};
+
+static void idt_set_gate(int vector, unsigned int handler) {
+    idt[vector].offset_low = handler & 0xFFFF;
+    idt[vector].selector = GDT_KERNEL_CODE;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = 0x8E; // Present, ring 0, 32-bit interrupt gate
+    idt[vector].offset_high = (handler >> 16) & 0xFFFF;
+}
+
+// Move the PIC IRQs off the CPU exception vectors and mask all of them
+static void pic_remap(void) {
+    outb(PIC1_CMD, 0x11);     // Start init sequence, expect ICW4
+    outb(PIC2_CMD, 0x11);
+    outb(PIC1_DATA, IRQ_BASE);
+    outb(PIC2_DATA, IRQ_BASE + 8);
+    outb(PIC1_DATA, 0x04);    // Slave PIC at IRQ2
+    outb(PIC2_DATA, 0x02);
+    outb(PIC1_DATA, 0x01);    // 8086 mode
+    outb(PIC2_DATA, 0x01);
+    outb(PIC1_DATA, 0xFB);    // Everything masked except the cascade
+    outb(PIC2_DATA, 0xFF);
+}
+
+void irq_unmask(int irq) {
+    unsigned short port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+void irq_mask(int irq) {
+    unsigned short port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+void isr_register(int vector, interrupt_handler handler) {
+    handlers[vector] = handler;
+}
+
+void irq_register(int irq, interrupt_handler handler) {
+    handlers[IRQ_BASE + irq] = handler;
+    irq_unmask(irq);
+}
+
+static void unhandled_exception(interrupt_frame *frame) {
+    vga_console_switch(vga_console_current()); // Show the faulting thread's console
+    kprintf("\nKernel panic: %s (vector %u, error %u)\nSystem halted.\n",
+            exception_names[frame->int_no], frame->int_no, frame->err_code);
+    vga_flush();
+    serial_flush();
+
+    asm volatile ("cli");
+    while (1) asm volatile ("hlt");
+}
+
+// Called from isr_common in isr.asm with interrupts disabled
+void interrupt_dispatch(interrupt_frame *frame) {
+    unsigned int vector = frame->int_no;
+
+    if (vector >= IRQ_BASE && vector < IRQ_BASE + 16) {
+        // Acknowledge first so a handler that never returns here
+        // (e.g. a context switch) does not leave the line blocked
+        if (vector >= IRQ_BASE + 8) {
+            outb(PIC2_CMD, PIC_EOI);
+        }
+        outb(PIC1_CMD, PIC_EOI);
+    } else if (vector >= IRQ_BASE + 16 && vector != LAPIC_SPURIOUS_VECTOR &&
+               lapic_present()) {
+        lapic_eoi(); // Local APIC vectors (timer, IPIs)
+    }
+
+    if (handlers[vector] != 0) {
+        handlers[vector](frame);
+    } else if (vector < 32) {
+        unhandled_exception(frame);
+    }
+
+    if (vector >= IRQ_BASE) {
+        sched_irq_exit(); // May switch threads; we resume here later
+    }
+}
+
+void idt_init(void) {
+    for (int i = 0; i < IDT_ENTRIES; i++) {
+        idt_set_gate(i, isr_stub_table[i]);
+        handlers[i] = 0;
+    }
+
+    pic_remap();
+
+    idtr.limit = sizeof(idt) - 1;
+    idtr.base = (unsigned int)&idt;
+    idt_load();
+}
+
+// Application processors share the BSP's table
+void idt_load(void) {
+    asm volatile ("lidt %0" : : "m"(idtr));
+}
@@ -0,0 +1,52 @@
+; isr.asm
+bits 32
+
+section .text
+extern interrupt_dispatch
+
+; One stub per vector. Exceptions that push an error code leave it on the
+; stack; every other vector pushes a dummy 0 so the frame layout matches
+; interrupt_frame in idt.h.
+%assign i 0
+%rep 256
+isr_stub_%+i:
+%if i == 8 || (i >= 10 && i <= 14) || i == 17 || i == 21 || i == 29 || i == 30
+%else
+    push dword 0
+%endif
+    push dword i
+    jmp isr_common
+%assign i i+1
+%endrep
+
+isr_common:
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+    mov ax, 0x10        ; Kernel data segment; %gs keeps the per-CPU base
+    mov ds, ax
+    mov es, ax
+    cld
+    push esp            ; interrupt_frame *
+    call interrupt_dispatch
+    add esp, 4
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popa
+    add esp, 8          ; Drop vector number and error code
+    iret
+
+section .data
+global isr_stub_table
+isr_stub_table:
+%assign i 0
+%rep 256
+    dd isr_stub_%+i
+%assign i i+1
+%endrep
+
+section .note.GNU-stack
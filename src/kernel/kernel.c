@@ -7,11 +7,65 @@
 #include "kernel/klib.h"
 #include "fs/fs.h"
 #include "drivers/vga.h"
+#include "gdt.h"
+#include "idt.h"
+#include "keyboard.h"
+#include "serial.h"
+#include "ata.h"
+#include "pci.h"
+#include "virtio_blk.h"
+#include "bcache.h"
+#include "timer.h"
+#include "pmm.h"
+#include "heap.h"
+#include "paging.h"
+#include "sched.h"
+#include "smp.h"
+#include "cpuid.h"
+#include "fpu.h"
+#include "multiboot.h"
+
+// Extra shells on the other virtual consoles (Alt+F2...)
+static void console_shell(void *arg) {
+    thread_current()->console = (int)arg;
+    vga_clear();
+    vga_puts("Welcome to ShOS!\n");
+    shell_run();
+}
+
+void kmain(unsigned int magic, multiboot_info *mbi) {
+    // CPU tables first so faults during memory setup get reported
+    gdt_init();
+    idt_init();
+    cpuid_init();
+    fpu_init();
+    kmem_init();
+
+    // Physical memory is tracked before anything can allocate
+    pmm_init(magic, mbi);
+    paging_init();
+    heap_init();
+    pci_init();   // Drivers from here on find their devices in its table
+
+    // Interrupt-driven input comes up before anything waits
+    timer_init();
+    vga_init();
+    sched_init();
+    keyboard_init();
+    if (serial_init() == 0) {
+        vga_mirror_attach(SERIAL_CONSOLE, serial_write);
+    }
+    asm volatile ("sti");
+
+    // Needs the PIT running to calibrate the local APIC timers
+    smp_init();
 
-void kmain() {
     show_splash_screen();
     
-    // Initialize systems - filesystem FIRST
+    // Initialize systems - filesystem FIRST, on the disk if there is one
+    bcache_init();
+    virtio_blk_init(); // Preferred over ATA when both are there
+    ata_init();
     fs_init();
     auth_init(); // This depends on filesystem
     
@@ -23,6 +77,9 @@ void kmain() {
     }
     
     // Login successful, start shell
+    for (int i = 1; i < VGA_CONSOLES; i++) {
+        thread_create("shell", console_shell, (void *)i, PRIORITY_NORMAL);
+    }
     vga_clear();
     vga_puts("Welcome to ShOS!\n");
     shell_run();
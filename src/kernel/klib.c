@@ -1,6 +1,7 @@
 // klib.c
 #include "klib.h"
 #include "vga.h"
+#include "keyboard.h"
 #include <stddef.h>
 
 int kstrlen(const char *s) {
@@ -18,19 +19,12 @@ int kstreq(const char *s1, const char *s2) {
 }
 
 void kstrcpy(char *dest, const char *src) {
-    while (*src) {
-        *dest++ = *src++;
-    }
-    *dest = '\0';
+    kmemcpy(dest, src, kstrlen(src) + 1);
 }
 
 // String concatenate function
 void kstrcat(char *dest, const char *src) {
-    while (*dest) dest++;
-    while (*src) {
-        *dest++ = *src++;
-    }
-    *dest = '\0';
+    kmemcpy(dest + kstrlen(dest), src, kstrlen(src) + 1);
 }
 
 void kgets(char *buf, int max) {
@@ -53,23 +47,10 @@ void kgets(char *buf, int max) {
 }
 
 char kgetchar(void) {
-    while ((inb(0x64) & 1) == 0); // Wait for data
-    unsigned char scancode = inb(0x60);
-    
-    static const char keymap[128] = {
-        0,   0,   '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
-        '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
-        0,   'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`', 0,   '\\',
-        'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,   '*',  0,   ' ', 0,
-        0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,    0,   0,   0,
-        0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,    0,   0,   0,
-        0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,    0,   0,   0,
-        0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,    0,   0,   0,
-        0,   0,   0,   0,   0,   0,   0,   0,   0
-    };
-    
+    vga_flush(); // Everything printed so far should be visible while we wait
+    unsigned char scancode = keyboard_read_scancode(); // Halts until a key arrives
     if (scancode < 0x80) {
-        return keymap[scancode];
+        return keyboard_keymap[scancode];
     }
     return 0;
 }
@@ -94,6 +75,26 @@ void outb(unsigned short port, unsigned char val) {
     asm volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
 }
 
+unsigned short inw(unsigned short port) {
+    unsigned short ret;
+    asm volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+void outw(unsigned short port, unsigned short val) {
+    asm volatile ("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+
+unsigned int inl(unsigned short port) {
+    unsigned int ret;
+    asm volatile ("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+void outl(unsigned short port, unsigned int val) {
+    asm volatile ("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
 int str_to_int(const char *str) {
     int result = 0;
     int sign = 1;
@@ -115,41 +116,3 @@ int str_to_int(const char *str) {
     
     return result * sign;
 }
-
-void int_to_str(int num, char *str) {
-    int i = 0;
-    int is_negative = 0;
-    
-    if (num < 0) {
-        is_negative = 1;
-        num = -num;
-    }
-    
-    if (num == 0) {
-        str[i++] = '0';
-        str[i] = '\0';
-        return;
-    }
-    
-    while (num != 0) {
-        int digit = num % 10;
-        str[i++] = '0' + digit;
-        num = num / 10;
-    }
-    
-    if (is_negative) {
-        str[i++] = '-';
-    }
-    
-    str[i] = '\0';
-    
-    int start = 0;
-    int end = i - 1;
-    while (start < end) {
-        char temp = str[start];
-        str[start] = str[end];
-        str[end] = temp;
-        start++;
-        end--;
-    }
-}
\ No newline at end of file
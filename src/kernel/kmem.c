@@ -0,0 +1,346 @@
+// kmem.c
+#include "kmem.h"
+#include "cpuid.h"
+
+// Below this the xmm save/restore and alignment work outweigh the wider
+// loads; rep movsd handles short runs well everywhere.
+#define SSE_MIN_SIZE 256
+// Copies larger than a typical L2 bypass the cache with streaming stores
+#define SSE_STREAM_SIZE (512 * 1024)
+
+// --- Plain C byte loops: the baseline every other variant must beat ---
+
+static void *copy_bytes(void *dest, const void *src, unsigned int n) {
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    while (n--) *d++ = *s++;
+    return dest;
+}
+
+static void *set_bytes(void *dest, int c, unsigned int n) {
+    unsigned char *d = dest;
+    while (n--) *d++ = (unsigned char)c;
+    return dest;
+}
+
+static int compare_bytes(const void *a, const void *b, unsigned int n) {
+    const unsigned char *p = a, *q = b;
+    for (unsigned int i = 0; i < n; i++) {
+        if (p[i] != q[i]) {
+            return p[i] - q[i];
+        }
+    }
+    return 0;
+}
+
+// --- String instructions, dword at a time: works on any i386 ---
+
+static void *copy_movsd(void *dest, const void *src, unsigned int n) {
+    int ecx, edi, esi;
+    asm volatile ("rep movsl\n\t"
+                  "mov %4, %%ecx\n\t"
+                  "rep movsb"
+                  : "=&c"(ecx), "=&D"(edi), "=&S"(esi)
+                  : "0"(n / 4), "r"(n & 3), "1"(dest), "2"(src)
+                  : "memory");
+    return dest;
+}
+
+static void *set_stosd(void *dest, int c, unsigned int n) {
+    unsigned int pattern = (unsigned char)c * 0x01010101u;
+    int ecx, edi;
+    asm volatile ("rep stosl\n\t"
+                  "mov %3, %%ecx\n\t"
+                  "rep stosb"
+                  : "=&c"(ecx), "=&D"(edi)
+                  : "0"(n / 4), "r"(n & 3), "1"(dest), "a"(pattern)
+                  : "memory");
+    return dest;
+}
+
+// Word compares until the first difference, then bytes to order it
+static int compare_words(const void *a, const void *b, unsigned int n) {
+    const unsigned int *p = a, *q = b;
+    unsigned int words = n / 4;
+    unsigned int i = 0;
+    while (i < words && p[i] == q[i]) {
+        i++;
+    }
+    return compare_bytes((const char *)a + i * 4, (const char *)b + i * 4,
+                         n - i * 4);
+}
+
+// --- ERMS: rep movsb/stosb are fast for any size and alignment ---
+
+static void *copy_erms(void *dest, const void *src, unsigned int n) {
+    int ecx, edi, esi;
+    asm volatile ("rep movsb"
+                  : "=c"(ecx), "=D"(edi), "=S"(esi)
+                  : "0"(n), "1"(dest), "2"(src)
+                  : "memory");
+    return dest;
+}
+
+static void *set_erms(void *dest, int c, unsigned int n) {
+    int ecx, edi;
+    asm volatile ("rep stosb"
+                  : "=c"(ecx), "=D"(edi)
+                  : "0"(n), "1"(dest), "a"(c)
+                  : "memory");
+    return dest;
+}
+
+// --- SSE2: 64 bytes per iteration ---
+// These may run in interrupt context, so the xmm registers they use are
+// saved and restored around the loop instead of being clobbered. The
+// first use in a thread still goes through the lazy #NM path in fpu.c.
+
+#define XMM_SAVE(buf) \
+    asm volatile ("movdqu %%xmm0, 0(%0)\n\t" \
+                  "movdqu %%xmm1, 16(%0)\n\t" \
+                  "movdqu %%xmm2, 32(%0)\n\t" \
+                  "movdqu %%xmm3, 48(%0)" : : "r"(buf) : "memory")
+
+#define XMM_RESTORE(buf) \
+    asm volatile ("movdqu 0(%0), %%xmm0\n\t" \
+                  "movdqu 16(%0), %%xmm1\n\t" \
+                  "movdqu 32(%0), %%xmm2\n\t" \
+                  "movdqu 48(%0), %%xmm3" : : "r"(buf) : "memory")
+
+static void *copy_sse2(void *dest, const void *src, unsigned int n) {
+    if (n < SSE_MIN_SIZE) {
+        return copy_movsd(dest, src, n);
+    }
+
+    // Align the destination so every store is an aligned one
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    unsigned int head = (16 - ((unsigned int)d & 15)) & 15;
+    copy_movsd(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    unsigned char saved[64];
+    unsigned int blocks = n / 64;
+    XMM_SAVE(saved);
+    if (n >= SSE_STREAM_SIZE) {
+        asm volatile ("1:\n\t"
+                      "movdqu 0(%1), %%xmm0\n\t"
+                      "movdqu 16(%1), %%xmm1\n\t"
+                      "movdqu 32(%1), %%xmm2\n\t"
+                      "movdqu 48(%1), %%xmm3\n\t"
+                      "movntdq %%xmm0, 0(%0)\n\t"
+                      "movntdq %%xmm1, 16(%0)\n\t"
+                      "movntdq %%xmm2, 32(%0)\n\t"
+                      "movntdq %%xmm3, 48(%0)\n\t"
+                      "add $64, %1\n\t"
+                      "add $64, %0\n\t"
+                      "dec %2\n\t"
+                      "jnz 1b\n\t"
+                      "sfence"
+                      : "+r"(d), "+r"(s), "+r"(blocks) : : "memory");
+    } else {
+        asm volatile ("1:\n\t"
+                      "movdqu 0(%1), %%xmm0\n\t"
+                      "movdqu 16(%1), %%xmm1\n\t"
+                      "movdqu 32(%1), %%xmm2\n\t"
+                      "movdqu 48(%1), %%xmm3\n\t"
+                      "movdqa %%xmm0, 0(%0)\n\t"
+                      "movdqa %%xmm1, 16(%0)\n\t"
+                      "movdqa %%xmm2, 32(%0)\n\t"
+                      "movdqa %%xmm3, 48(%0)\n\t"
+                      "add $64, %1\n\t"
+                      "add $64, %0\n\t"
+                      "dec %2\n\t"
+                      "jnz 1b"
+                      : "+r"(d), "+r"(s), "+r"(blocks) : : "memory");
+    }
+    XMM_RESTORE(saved);
+
+    copy_movsd(d, s, n & 63);
+    return dest;
+}
+
+static void *set_sse2(void *dest, int c, unsigned int n) {
+    if (n < SSE_MIN_SIZE) {
+        return set_stosd(dest, c, n);
+    }
+
+    unsigned char *d = dest;
+    unsigned int head = (16 - ((unsigned int)d & 15)) & 15;
+    set_stosd(d, c, head);
+    d += head;
+    n -= head;
+
+    unsigned char saved[64];
+    unsigned int pattern = (unsigned char)c * 0x01010101u;
+    unsigned int blocks = n / 64;
+    XMM_SAVE(saved);
+    asm volatile ("movd %2, %%xmm0\n\t"
+                  "pshufd $0, %%xmm0, %%xmm0\n\t"
+                  "1:\n\t"
+                  "movdqa %%xmm0, 0(%0)\n\t"
+                  "movdqa %%xmm0, 16(%0)\n\t"
+                  "movdqa %%xmm0, 32(%0)\n\t"
+                  "movdqa %%xmm0, 48(%0)\n\t"
+                  "add $64, %0\n\t"
+                  "dec %1\n\t"
+                  "jnz 1b"
+                  : "+r"(d), "+r"(blocks) : "r"(pattern) : "memory");
+    XMM_RESTORE(saved);
+
+    set_stosd(d, c, n & 63);
+    return dest;
+}
+
+static int compare_sse2(const void *a, const void *b, unsigned int n) {
+    if (n < SSE_MIN_SIZE) {
+        return compare_words(a, b, n);
+    }
+
+    const unsigned char *p = a, *q = b;
+    unsigned int blocks = n / 16;
+    unsigned int mask;
+    unsigned char saved[64];
+    XMM_SAVE(saved);
+    // Stops at the first 16-byte block holding a difference
+    asm volatile ("1:\n\t"
+                  "movdqu (%0), %%xmm0\n\t"
+                  "movdqu (%1), %%xmm1\n\t"
+                  "pcmpeqb %%xmm1, %%xmm0\n\t"
+                  "pmovmskb %%xmm0, %3\n\t"
+                  "cmp $0xFFFF, %3\n\t"
+                  "jne 2f\n\t"
+                  "add $16, %0\n\t"
+                  "add $16, %1\n\t"
+                  "dec %2\n\t"
+                  "jnz 1b\n\t"
+                  "2:"
+                  : "+r"(p), "+r"(q), "+r"(blocks), "=&r"(mask) : : "memory", "cc");
+    XMM_RESTORE(saved);
+
+    return compare_bytes(p, q, n - (p - (const unsigned char *)a));
+}
+
+static kmem_variant variants[] = {
+    {"bytes", 1, copy_bytes, set_bytes, compare_bytes},
+    {"rep movsd", 1, copy_movsd, set_stosd, compare_words},
+    {"erms", 0, copy_erms, set_erms, compare_words},
+    {"sse2", 0, copy_sse2, set_sse2, compare_sse2},
+};
+
+#define VARIANT_COUNT ((int)(sizeof(variants) / sizeof(variants[0])))
+
+// Safe defaults until kmem_init has looked at CPUID
+static const kmem_variant *copy_impl = &variants[1];
+static const kmem_variant *set_impl = &variants[1];
+static const kmem_variant *compare_impl = &variants[1];
+
+void kmem_init(void) {
+    variants[2].available = cpu_features.erms;
+    variants[3].available = cpu_features.sse2 && cpu_features.fxsr;
+
+    // ERMS string ops match SSE2 loops on large blocks without touching
+    // FPU state, so prefer them; compare has no fast string form.
+    if (variants[2].available) {
+        copy_impl = &variants[2];
+        set_impl = &variants[2];
+    } else if (variants[3].available) {
+        copy_impl = &variants[3];
+        set_impl = &variants[3];
+    }
+    if (variants[3].available) {
+        compare_impl = &variants[3];
+    }
+}
+
+void *kmemcpy(void *dest, const void *src, unsigned int n) {
+    return copy_impl->copy(dest, src, n);
+}
+
+void *kmemset(void *dest, int c, unsigned int n) {
+    return set_impl->set(dest, c, n);
+}
+
+int kmemcmp(const void *a, const void *b, unsigned int n) {
+    return compare_impl->compare(a, b, n);
+}
+
+void *kmemmove(void *dest, const void *src, unsigned int n) {
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+
+    // Every forward variant reads a block before writing it, so a
+    // destination below the source is safe to copy forwards
+    if (d <= s || d >= s + n) {
+        return copy_impl->copy(dest, src, n);
+    }
+
+    while (n & 3) {
+        n--;
+        d[n] = s[n];
+    }
+    unsigned int *dw = (unsigned int *)d;
+    const unsigned int *sw = (const unsigned int *)s;
+    for (unsigned int i = n / 4; i-- > 0;) {
+        dw[i] = sw[i];
+    }
+    return dest;
+}
+
+// Fill count 16-bit cells, e.g. VGA characters with their attribute
+void *kmemsetw(void *dest, unsigned short value, unsigned int count) {
+    unsigned int pattern = value | ((unsigned int)value << 16);
+    int ecx, edi;
+    asm volatile ("rep stosl\n\t"
+                  "mov %3, %%ecx\n\t"
+                  "rep stosw"
+                  : "=&c"(ecx), "=&D"(edi)
+                  : "0"(count / 2), "r"(count & 1), "1"(dest), "a"(pattern)
+                  : "memory");
+    return dest;
+}
+
+int kmem_variant_count(void) {
+    return VARIANT_COUNT;
+}
+
+const kmem_variant *kmem_variant_get(int index) {
+    if (index < 0 || index >= VARIANT_COUNT) {
+        return 0;
+    }
+    return &variants[index];
+}
+
+const char *kmem_selected(void) {
+    static char desc[64];
+    const char *parts[] = {"copy ", copy_impl->name, ", set ", set_impl->name,
+                           ", cmp ", compare_impl->name};
+    int len = 0;
+    for (int i = 0; i < 6; i++) {
+        for (const char *s = parts[i]; *s && len < 63; s++) {
+            desc[len++] = *s;
+        }
+    }
+    desc[len] = '\0';
+    return desc;
+}
+
+// GCC may emit calls to these for struct copies and large initializers,
+// even in freestanding code
+void *memcpy(void *dest, const void *src, unsigned int n) {
+    return kmemcpy(dest, src, n);
+}
+
+void *memmove(void *dest, const void *src, unsigned int n) {
+    return kmemmove(dest, src, n);
+}
+
+void *memset(void *dest, int c, unsigned int n) {
+    return kmemset(dest, c, n);
+}
+
+int memcmp(const void *a, const void *b, unsigned int n) {
+    return kmemcmp(a, b, n);
+}
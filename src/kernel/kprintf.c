@@ -0,0 +1,271 @@
+// kprintf.c
+#include "kprintf.h"
+#include "vga.h"
+
+#define FLAG_LEFT 0x01
+#define FLAG_ZERO 0x02
+#define NUMBER_MAX 24       // Digits of a 64-bit value plus sign
+
+// Two decimal digits per lookup halves the divisions per number
+static const char digit_pairs[201] =
+    "00010203040506070809" "10111213141516171819"
+    "20212223242526272829" "30313233343536373839"
+    "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879"
+    "80818283848586878889" "90919293949596979899";
+
+// Where formatted text goes: a caller's buffer, truncated (flush == 0),
+// or a staging buffer handed to flush whenever it fills up
+typedef struct {
+    char *buf;
+    unsigned int size;
+    unsigned int len;
+    unsigned int total;
+    void (*flush)(const char *buf, unsigned int len);
+} output;
+
+static void out_bytes(output *out, const char *s, unsigned int n) {
+    out->total += n;
+    while (n > 0) {
+        if (out->len == out->size) {
+            if (out->flush == 0) {
+                return;
+            }
+            out->flush(out->buf, out->len);
+            out->len = 0;
+        }
+        unsigned int chunk = out->size - out->len;
+        if (chunk > n) chunk = n;
+        for (unsigned int i = 0; i < chunk; i++) {
+            out->buf[out->len + i] = s[i];
+        }
+        out->len += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+static void out_repeat(output *out, char c, int n) {
+    char run[16];
+    for (int i = 0; i < 16; i++) run[i] = c;
+    while (n > 0) {
+        int chunk = n < 16 ? n : 16;
+        out_bytes(out, run, chunk);
+        n -= chunk;
+    }
+}
+
+// Digits are written backwards from end; both return the first digit
+static char *format_u32(char *end, unsigned int value) {
+    while (value >= 100) {
+        unsigned int q = value / 100;
+        unsigned int r = (value - q * 100) * 2;
+        end -= 2;
+        end[0] = digit_pairs[r];
+        end[1] = digit_pairs[r + 1];
+        value = q;
+    }
+    if (value >= 10) {
+        end -= 2;
+        end[0] = digit_pairs[value * 2];
+        end[1] = digit_pairs[value * 2 + 1];
+    } else {
+        *--end = '0' + value;
+    }
+    return end;
+}
+
+// There is no libgcc for 64-bit division, so peel off nine digits at a
+// time with divl: reducing the high half first keeps the quotient in
+// 32 bits
+static char *format_u64(char *end, unsigned long long value) {
+    while (value >> 32) {
+        unsigned int high = value >> 32;
+        unsigned int low = (unsigned int)value;
+        unsigned int q_high = high / 1000000000u;
+        unsigned int q_low, rem;
+        asm ("divl %4"
+             : "=a"(q_low), "=d"(rem)
+             : "a"(low), "d"(high % 1000000000u), "rm"(1000000000u));
+
+        char *start = format_u32(end, rem);
+        while (start > end - 9) {
+            *--start = '0';
+        }
+        end = start;
+        value = ((unsigned long long)q_high << 32) | q_low;
+    }
+    return format_u32(end, (unsigned int)value);
+}
+
+static char *format_hex(char *end, unsigned long long value, int upper) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do {
+        *--end = digits[value & 0xF];
+        value >>= 4;
+    } while (value != 0);
+    return end;
+}
+
+// Pad a formatted field; zero padding goes between the sign and digits
+static void out_field(output *out, const char *prefix, const char *s,
+                      unsigned int len, int width, int flags) {
+    int plen = 0;
+    while (prefix[plen]) plen++;
+    int pad = width - (int)len - plen;
+
+    if (flags & FLAG_LEFT) {
+        out_bytes(out, prefix, plen);
+        out_bytes(out, s, len);
+        out_repeat(out, ' ', pad);
+    } else if (flags & FLAG_ZERO) {
+        out_bytes(out, prefix, plen);
+        out_repeat(out, '0', pad);
+        out_bytes(out, s, len);
+    } else {
+        out_repeat(out, ' ', pad);
+        out_bytes(out, prefix, plen);
+        out_bytes(out, s, len);
+    }
+}
+
+static void format(output *out, const char *fmt, va_list args) {
+    char number[NUMBER_MAX];
+    char *end = number + NUMBER_MAX;
+
+    while (*fmt) {
+        // Literal runs go out in one piece
+        const char *run = fmt;
+        while (*fmt && *fmt != '%') fmt++;
+        if (fmt > run) {
+            out_bytes(out, run, fmt - run);
+        }
+        if (*fmt == '\0') {
+            break;
+        }
+        fmt++;
+
+        int flags = 0;
+        for (;; fmt++) {
+            if (*fmt == '-') flags |= FLAG_LEFT;
+            else if (*fmt == '0') flags |= FLAG_ZERO;
+            else break;
+        }
+        int width = 0;
+        if (*fmt == '*') {
+            width = va_arg(args, int);
+            if (width < 0) {
+                flags |= FLAG_LEFT;
+                width = -width;
+            }
+            fmt++;
+        }
+        while (*fmt >= '0' && *fmt <= '9') {
+            width = width * 10 + (*fmt++ - '0');
+        }
+        int longs = 0;
+        while (*fmt == 'l') {
+            longs++;
+            fmt++;
+        }
+
+        const char *prefix = "";
+        char *digits;
+        switch (*fmt) {
+        case 'd':
+        case 'i': {
+            long long value = longs >= 2 ? va_arg(args, long long)
+                                         : va_arg(args, int);
+            unsigned long long magnitude = value;
+            if (value < 0) {
+                prefix = "-";
+                magnitude = 0 - magnitude;
+            }
+            digits = format_u64(end, magnitude);
+            out_field(out, prefix, digits, end - digits, width, flags);
+            break;
+        }
+        case 'u': {
+            unsigned long long value = longs >= 2 ? va_arg(args, unsigned long long)
+                                                  : va_arg(args, unsigned int);
+            digits = format_u64(end, value);
+            out_field(out, prefix, digits, end - digits, width, flags);
+            break;
+        }
+        case 'x':
+        case 'X': {
+            unsigned long long value = longs >= 2 ? va_arg(args, unsigned long long)
+                                                  : va_arg(args, unsigned int);
+            digits = format_hex(end, value, *fmt == 'X');
+            out_field(out, prefix, digits, end - digits, width, flags);
+            break;
+        }
+        case 'p': {
+            // Always the full eight digits, like an address in a dump
+            digits = format_hex(end, (unsigned int)va_arg(args, void *), 0);
+            out_field(out, "0x", digits, end - digits, 10, FLAG_ZERO);
+            break;
+        }
+        case 's': {
+            const char *s = va_arg(args, const char *);
+            if (s == 0) s = "(null)";
+            unsigned int len = 0;
+            while (s[len]) len++;
+            out_field(out, prefix, s, len, width, flags & FLAG_LEFT);
+            break;
+        }
+        case 'c': {
+            char c = (char)va_arg(args, int);
+            out_field(out, prefix, &c, 1, width, flags & FLAG_LEFT);
+            break;
+        }
+        case '%':
+            out_bytes(out, "%", 1);
+            break;
+        default:
+            // Unknown conversion: show it rather than eat arguments
+            out_bytes(out, "%", 1);
+            if (*fmt == '\0') {
+                return;
+            }
+            out_bytes(out, fmt, 1);
+            break;
+        }
+        fmt++;
+    }
+}
+
+int kvsnprintf(char *buf, unsigned int size, const char *fmt, va_list args) {
+    output out = {buf, size > 0 ? size - 1 : 0, 0, 0, 0};
+    format(&out, fmt, args);
+    if (size > 0) {
+        buf[out.len] = '\0';
+    }
+    return out.total;
+}
+
+int ksnprintf(char *buf, unsigned int size, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
+
+int kvprintf(const char *fmt, va_list args) {
+    char buf[KPRINTF_BUFFER];
+    output out = {buf, KPRINTF_BUFFER, 0, 0, vga_write};
+    format(&out, fmt, args);
+    if (out.len > 0) {
+        vga_write(buf, out.len);
+    }
+    return out.total;
+}
+
+int kprintf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = kvprintf(fmt, args);
+    va_end(args);
+    return len;
+}
@@ -0,0 +1,98 @@
+// paging.c
+#include "paging.h"
+#include "pmm.h"
+#include "idt.h"
+#include "klib.h"
+#include "vga.h"
+#include "serial.h"
+#include "kprintf.h"
+
+#define PDE_INDEX(addr) ((unsigned int)(addr) >> 22)
+
+extern char kernel_end[];
+
+// Low 4 MiB go through a page table so page 0 can stay unmapped and catch
+// NULL dereferences; everything else uses 4 MiB pages to keep the TLB
+// footprint to a handful of entries.
+static unsigned int page_directory[1024] __attribute__((aligned(PAGE_SIZE)));
+static unsigned int low_page_table[1024] __attribute__((aligned(PAGE_SIZE)));
+
+static void page_fault_handler(interrupt_frame *frame) {
+    unsigned int fault_addr;
+    asm volatile ("mov %%cr2, %0" : "=r"(fault_addr));
+    vga_console_switch(vga_console_current()); // Show the faulting thread's console
+
+    kprintf("\nPage fault at 0x%08X%s\n  %s%s%s, eip 0x%08X, error %u\nSystem halted.\n",
+            fault_addr, fault_addr < PAGE_SIZE ? " (NULL pointer)" : "",
+            frame->err_code & 1 ? "protection violation" : "page not present",
+            frame->err_code & 2 ? " on write" : " on read",
+            frame->err_code & 16 ? " (instruction fetch)" : "",
+            frame->eip, frame->err_code);
+    vga_flush();
+    serial_flush();
+
+    asm volatile ("cli");
+    while (1) asm volatile ("hlt");
+}
+
+void paging_init(void) {
+    unsigned int flags = PAGE_PRESENT | PAGE_WRITABLE;
+
+    // 0-4 MiB: identity mapped 4 KB pages, except page 0. This also covers
+    // the VGA text buffer at 0xB8000.
+    low_page_table[0] = 0;
+    for (unsigned int i = 1; i < 1024; i++) {
+        low_page_table[i] = (i * PAGE_SIZE) | flags;
+    }
+    for (unsigned int i = 0; i < 1024; i++) {
+        page_directory[i] = 0;
+    }
+    page_directory[0] = V2P(low_page_table) | flags;
+
+    // Identity map the rest of RAM with large pages
+    unsigned int top = pmm_memory_top();
+    for (unsigned int i = 1; i < PDE_INDEX(top + LARGE_PAGE_SIZE - 1); i++) {
+        page_directory[i] = (i * LARGE_PAGE_SIZE) | flags | PAGE_LARGE;
+    }
+
+    // Higher-half alias of the kernel image
+    unsigned int kernel_pages = PDE_INDEX(V2P(kernel_end) + LARGE_PAGE_SIZE - 1);
+    for (unsigned int i = 0; i < kernel_pages; i++) {
+        page_directory[PDE_INDEX(KERNEL_VIRT_BASE) + i] =
+            (i * LARGE_PAGE_SIZE) | flags | PAGE_LARGE;
+    }
+
+    isr_register(14, page_fault_handler);
+
+    // boot.asm already enabled PSE and paging; switching CR3 flushes the TLB
+    asm volatile ("mov %0, %%cr3" : : "r"(V2P(page_directory)) : "memory");
+}
+
+// Identity map a device window with uncached 4 MiB pages
+int paging_map_mmio(unsigned int phys, unsigned int size) {
+    unsigned int first = PDE_INDEX(phys);
+    unsigned int last = PDE_INDEX(phys + size - 1);
+
+    for (unsigned int i = first; i <= last; i++) {
+        unsigned int entry = page_directory[i];
+        if (entry != 0 && (entry & ~(LARGE_PAGE_SIZE - 1)) != i * LARGE_PAGE_SIZE) {
+            return -1; // Slot already maps something else (the kernel image)
+        }
+        if (entry == 0) {
+            page_directory[i] = (i * LARGE_PAGE_SIZE) | PAGE_PRESENT |
+                                PAGE_WRITABLE | PAGE_WRITE_THROUGH |
+                                PAGE_CACHE_DISABLE | PAGE_LARGE;
+            asm volatile ("invlpg (%0)" : : "r"(i * LARGE_PAGE_SIZE) : "memory");
+        }
+    }
+    return 0;
+}
+
+unsigned int virt_to_phys(const void *addr) {
+    unsigned int a = (unsigned int)addr;
+    return a >= KERNEL_VIRT_BASE ? V2P(a) : a;
+}
+
+unsigned int paging_directory_phys(void) {
+    return V2P(page_directory);
+}
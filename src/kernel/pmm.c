@@ -0,0 +1,259 @@
+// pmm.c
+#include "pmm.h"
+#include "klib.h"
+#include "paging.h"
+#include "spinlock.h"
+
+#define LOW_MEMORY_END 0x100000  // BIOS, VGA and real-mode structures
+
+// Provided by linker.ld (higher-half virtual addresses)
+extern char kernel_start[];
+extern char kernel_end[];
+
+// One bit per 4 KB frame, set = in use. The bitmap is sized from the
+// memory map and placed in the first free spot after the kernel image.
+static unsigned int *frame_bitmap;
+static unsigned int bitmap_words;
+static unsigned int frame_limit;   // Frames covered by the bitmap
+static unsigned int usable_frames;
+static unsigned int free_frames;
+static unsigned int search_hint;   // Lowest word that may have a free bit
+static spinlock pmm_lock = SPINLOCK_INIT;
+
+static void frame_set(unsigned int frame) {
+    frame_bitmap[frame >> 5] |= 1u << (frame & 31);
+}
+
+static void frame_clear(unsigned int frame) {
+    frame_bitmap[frame >> 5] &= ~(1u << (frame & 31));
+}
+
+static int frame_test(unsigned int frame) {
+    return (frame_bitmap[frame >> 5] >> (frame & 31)) & 1;
+}
+
+static unsigned int page_align_up(unsigned int addr) {
+    return (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+// Clamp a map entry to allocatable memory; returns 0 if nothing is left
+static int region_bounds(multiboot_mmap_entry *entry,
+                         unsigned int *start, unsigned int *end) {
+    unsigned long long base = entry->addr;
+    unsigned long long limit = entry->addr + entry->len;
+
+    // Frames must be reachable through the identity map below the kernel
+    if (limit > KERNEL_VIRT_BASE) {
+        limit = KERNEL_VIRT_BASE;
+    }
+    if (base >= limit) {
+        return 0;
+    }
+    *start = page_align_up((unsigned int)base);
+    *end = (unsigned int)limit & ~(PAGE_SIZE - 1);
+    return *end > *start;
+}
+
+#define for_each_mmap_entry(entry, mbi) \
+    for (entry = (multiboot_mmap_entry *)(mbi)->mmap_addr; \
+         (unsigned int)entry < (mbi)->mmap_addr + (mbi)->mmap_length; \
+         entry = (multiboot_mmap_entry *)((unsigned int)entry + entry->size + 4))
+
+// Mark [start, end) as in use without touching frames outside the bitmap
+static void reserve_range(unsigned int start, unsigned int end) {
+    for (unsigned int f = start >> PAGE_SHIFT;
+         f < (page_align_up(end) >> PAGE_SHIFT) && f < frame_limit; f++) {
+        if (!frame_test(f)) {
+            frame_set(f);
+            free_frames--;
+        }
+    }
+}
+
+static void release_range(unsigned int start, unsigned int end) {
+    for (unsigned int f = start >> PAGE_SHIFT; f < (end >> PAGE_SHIFT); f++) {
+        if (frame_test(f)) {
+            frame_clear(f);
+            free_frames++;
+        }
+    }
+}
+
+void pmm_init(unsigned int magic, multiboot_info *mbi) {
+    multiboot_mmap_entry *entry;
+    multiboot_mmap_entry fallback;
+    multiboot_info fake;
+    unsigned int top = 0;
+
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+        // No loader information: assume the 16 MB minimum the kernel needs
+        fake.flags = MULTIBOOT_INFO_MEMORY;
+        fake.mem_upper = 15 * 1024;
+        mbi = &fake;
+    }
+
+    if (!(mbi->flags & MULTIBOOT_INFO_MEM_MAP)) {
+        // Only the mem_upper summary is available: one region above 1 MB
+        fallback.size = sizeof(fallback) - 4;
+        fallback.addr = LOW_MEMORY_END;
+        fallback.len = (unsigned long long)mbi->mem_upper * 1024;
+        fallback.type = MULTIBOOT_MEMORY_AVAILABLE;
+        fake.flags = mbi->flags;
+        fake.mmap_addr = (unsigned int)&fallback;
+        fake.mmap_length = sizeof(fallback);
+        mbi = &fake;
+    }
+
+    // Size the bitmap to the end of the highest usable region
+    for_each_mmap_entry(entry, mbi) {
+        unsigned int start, end;
+        if (entry->type == MULTIBOOT_MEMORY_AVAILABLE &&
+            region_bounds(entry, &start, &end) && end > top) {
+            top = end;
+        }
+    }
+    frame_limit = top >> PAGE_SHIFT;
+    bitmap_words = (frame_limit + 31) / 32;
+
+    // Place the bitmap in the first usable gap above the kernel image
+    unsigned int bitmap_bytes = page_align_up(bitmap_words * 4);
+    unsigned int kernel_phys_end = page_align_up(V2P(kernel_end));
+    frame_bitmap = 0;
+    for_each_mmap_entry(entry, mbi) {
+        unsigned int start, end;
+        if (entry->type != MULTIBOOT_MEMORY_AVAILABLE ||
+            !region_bounds(entry, &start, &end)) {
+            continue;
+        }
+        if (start < kernel_phys_end) {
+            start = kernel_phys_end;
+        }
+        if (start < end && end - start >= bitmap_bytes) {
+            frame_bitmap = (unsigned int *)start;
+            break;
+        }
+    }
+    if (frame_bitmap == 0) {
+        return; // Nowhere to track memory; every allocation will fail
+    }
+
+    // Start with everything in use, then release what the loader reports
+    kmemset(frame_bitmap, 0xFF, bitmap_words * sizeof(unsigned int));
+    free_frames = 0;
+    for_each_mmap_entry(entry, mbi) {
+        unsigned int start, end;
+        if (entry->type == MULTIBOOT_MEMORY_AVAILABLE &&
+            region_bounds(entry, &start, &end)) {
+            release_range(start, end);
+        }
+    }
+    usable_frames = free_frames;
+
+    reserve_range(0, LOW_MEMORY_END);
+    reserve_range(V2P(kernel_start), V2P(kernel_end));
+    reserve_range((unsigned int)frame_bitmap,
+                  (unsigned int)frame_bitmap + bitmap_bytes);
+    search_hint = 0;
+}
+
+static unsigned int alloc_frame_locked(void) {
+    for (unsigned int i = search_hint; i < bitmap_words; i++) {
+        // Skip fully used words 32 frames at a time
+        if (frame_bitmap[i] == 0xFFFFFFFF) {
+            continue;
+        }
+        for (unsigned int bit = 0; bit < 32; bit++) {
+            unsigned int frame = i * 32 + bit;
+            if (frame < frame_limit && !frame_test(frame)) {
+                frame_set(frame);
+                free_frames--;
+                search_hint = i;
+                return frame << PAGE_SHIFT;
+            }
+        }
+    }
+    return 0;
+}
+
+static unsigned int alloc_frames_locked(unsigned int count) {
+    if (count == 1) {
+        return alloc_frame_locked();
+    }
+    if (count == 0 || count > free_frames) {
+        return 0;
+    }
+
+    unsigned int run = 0;
+    for (unsigned int frame = search_hint * 32; frame < frame_limit; frame++) {
+        if ((frame & 31) == 0 && frame_bitmap[frame >> 5] == 0xFFFFFFFF) {
+            run = 0;
+            frame += 31;
+            continue;
+        }
+        if (frame_test(frame)) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) {
+            unsigned int first = frame + 1 - count;
+            for (unsigned int f = first; f <= frame; f++) {
+                frame_set(f);
+            }
+            free_frames -= count;
+            return first << PAGE_SHIFT;
+        }
+    }
+    return 0;
+}
+
+static void free_frame_locked(unsigned int addr) {
+    unsigned int frame = addr >> PAGE_SHIFT;
+    if (frame >= frame_limit || !frame_test(frame)) {
+        return; // Double free or foreign address
+    }
+    frame_clear(frame);
+    free_frames++;
+    if ((frame >> 5) < search_hint) {
+        search_hint = frame >> 5;
+    }
+}
+
+unsigned int pmm_alloc_frame(void) {
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int addr = alloc_frame_locked();
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return addr;
+}
+
+unsigned int pmm_alloc_frames(unsigned int count) {
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int addr = alloc_frames_locked(count);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return addr;
+}
+
+void pmm_free_frame(unsigned int addr) {
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    free_frame_locked(addr);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+void pmm_free_frames(unsigned int addr, unsigned int count) {
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    for (unsigned int i = 0; i < count; i++) {
+        free_frame_locked(addr + i * PAGE_SIZE);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+unsigned int pmm_total_frames(void) {
+    return usable_frames;
+}
+
+unsigned int pmm_free_count(void) {
+    return free_frames;
+}
+
+unsigned int pmm_memory_top(void) {
+    return frame_limit << PAGE_SHIFT;
+}
@@ -0,0 +1,428 @@
+// sched.c
+#include "sched.h"
+#include "heap.h"
+#include "fpu.h"
+#include "idt.h"
+#include "klib.h"
+#include "file.h"
+
+extern void switch_context(unsigned int *old_esp, unsigned int new_esp);
+
+cpu cpus[MAX_CPUS];
+int cpu_count = 1;
+
+static spinlock threads_lock = SPINLOCK_INIT;
+static thread *all_threads = 0;
+static unsigned int next_thread_id = 0;
+static thread boot_thread;
+static ktimer tick_timer;
+
+static void queue_push(thread_queue *q, thread *t) {
+    t->next = 0;
+    if (q->tail != 0) {
+        q->tail->next = t;
+    } else {
+        q->head = t;
+    }
+    q->tail = t;
+}
+
+static thread *queue_pop(thread_queue *q) {
+    thread *t = q->head;
+    if (t != 0) {
+        q->head = t->next;
+        if (q->head == 0) {
+            q->tail = 0;
+        }
+        t->next = 0;
+    }
+    return t;
+}
+
+// Run queue helpers; c->lock must be held
+static void rq_push(cpu *c, thread *t) {
+    queue_push(&c->run_queue[t->priority], t);
+    c->nr_ready++;
+}
+
+static thread *rq_pop(cpu *c) {
+    for (int p = 0; p < SCHED_PRIORITIES; p++) {
+        thread *t = queue_pop(&c->run_queue[p]);
+        if (t != 0) {
+            c->nr_ready--;
+            return t;
+        }
+    }
+    return 0;
+}
+
+// Take the oldest ready thread from the CPU with the longest queue
+static thread *steal_work(cpu *self) {
+    cpu *victim = 0;
+    unsigned int longest = 0;
+
+    for (int i = 0; i < cpu_count; i++) {
+        if (&cpus[i] != self && cpus[i].online && cpus[i].nr_ready > longest) {
+            victim = &cpus[i];
+            longest = cpus[i].nr_ready;
+        }
+    }
+    if (victim == 0) {
+        return 0;
+    }
+
+    spin_lock(&victim->lock);
+    thread *t = rq_pop(victim);
+    spin_unlock(&victim->lock);
+    return t;
+}
+
+static void thread_free(thread *t) {
+    unsigned int flags = spin_lock_irqsave(&threads_lock);
+    thread **link = &all_threads;
+    while (*link != t) {
+        link = &(*link)->all_next;
+    }
+    *link = t->all_next;
+    spin_unlock_irqrestore(&threads_lock, flags);
+
+    fpu_state_free(t);
+    kfree(t->stack);
+    kfree(t);
+}
+
+// Runs on the new stack right after every switch: only now is the previous
+// thread's context saved, so only now may another CPU pick it up.
+static void finish_switch(void) {
+    thread *prev = this_cpu()->switch_prev;
+    __sync_synchronize();
+    prev->on_cpu = 0;
+    if (prev->state == THREAD_DEAD) {
+        thread_free(prev);
+    }
+}
+
+// Switch to the most urgent ready thread. Interrupts must be disabled.
+static void schedule(void) {
+    cpu *c = this_cpu();
+    thread *prev = c->current;
+
+    spin_lock(&c->lock);
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+        if (prev != c->idle) {
+            rq_push(c, prev);
+        }
+    }
+    // A thread woken early is already READY and queued; don't queue it twice
+    thread *next = rq_pop(c);
+    spin_unlock(&c->lock);
+
+    if (next == 0) {
+        next = steal_work(c);
+    }
+    if (next == 0) {
+        next = c->idle;
+    }
+
+    c->need_resched = 0;
+    next->slice_left = SCHED_TIMESLICE_MS;
+    if (next == prev) {
+        prev->state = THREAD_RUNNING;
+        return;
+    }
+
+    // The thread may still be saving its registers on its previous CPU
+    while (next->on_cpu) {
+        asm volatile ("pause");
+    }
+    next->state = THREAD_RUNNING;
+    next->on_cpu = 1;
+    next->cpu = c->index;
+    c->current = next;
+    c->switch_prev = prev;
+
+    fpu_switch_out(prev);
+    switch_context(&prev->esp, next->esp);
+    finish_switch();
+}
+
+static void make_ready(thread *t) {
+    cpu *c = &cpus[t->cpu];
+    unsigned int flags = spin_lock_irqsave(&c->lock);
+    t->state = THREAD_READY;
+    rq_push(c, t);
+    // Other CPUs notice on their next timer tick
+    if (c->current == c->idle || t->priority < c->current->priority) {
+        c->need_resched = 1;
+    }
+    spin_unlock_irqrestore(&c->lock, flags);
+}
+
+void sched_tick(void) {
+    cpu *c = this_cpu();
+    thread *cur = c->current;
+    if (cur == 0) {
+        return;
+    }
+
+    cur->cpu_ms++;
+    if (cur == c->idle) {
+        c->idle_ms++;
+    } else {
+        c->busy_ms++;
+        c->window_busy++;
+        if (cur->slice_left > 0) {
+            cur->slice_left--;
+        }
+        if (cur->slice_left == 0) {
+            c->need_resched = 1;
+        }
+    }
+
+    if (++c->window_ticks == 1000) {
+        c->utilization = c->window_busy / 10;
+        c->window_ticks = 0;
+        c->window_busy = 0;
+    }
+}
+
+static void global_tick(void *arg) {
+    (void)arg;
+    sched_tick();
+}
+
+void sched_use_local_timers(void) {
+    timer_cancel(&tick_timer);
+}
+
+void sched_irq_exit(void) {
+    cpu *c = this_cpu();
+    if (c->need_resched && c->current != 0) {
+        schedule();
+    }
+}
+
+// First code run by every new thread; we arrive here from switch_context
+static void thread_start(void) {
+    finish_switch();
+    thread *self = this_cpu()->current; // Before sti, while we can't move
+    asm volatile ("sti");
+    self->entry(self->arg);
+    thread_exit();
+}
+
+static void idle_loop(void *arg) {
+    (void)arg;
+    while (1) {
+        asm volatile ("hlt");
+        // Woken by an interrupt; run anything readied here or elsewhere
+        unsigned int flags = irq_save();
+        schedule();
+        irq_restore(flags);
+    }
+}
+
+static void copy_name(char *dest, const char *name) {
+    int i = 0;
+    for (; name[i] && i < THREAD_NAME_LEN - 1; i++) {
+        dest[i] = name[i];
+    }
+    dest[i] = '\0';
+}
+
+static void register_thread(thread *t) {
+    unsigned int flags = spin_lock_irqsave(&threads_lock);
+    t->id = next_thread_id++;
+    t->all_next = all_threads;
+    all_threads = t;
+    spin_unlock_irqrestore(&threads_lock, flags);
+}
+
+void sched_init(void) {
+    cpu *c = this_cpu();
+
+    // The code already running on the boot stack becomes thread 0
+    copy_name(boot_thread.name, "kmain");
+    boot_thread.state = THREAD_RUNNING;
+    boot_thread.priority = PRIORITY_NORMAL;
+    boot_thread.slice_left = SCHED_TIMESLICE_MS;
+    boot_thread.on_cpu = 1;
+    fpu_state_alloc(&boot_thread);
+    register_thread(&boot_thread);
+    c->current = &boot_thread;
+    c->online = 1;
+
+    c->idle = thread_create("idle", idle_loop, 0, PRIORITY_LOW);
+
+    // Drive preemption from the timer wheel until per-CPU timers exist
+    timer_start(&tick_timer, 1, 1, global_tick, 0);
+}
+
+void sched_init_ap(void *boot_stack) {
+    cpu *c = this_cpu();
+    thread *idle = kzalloc(sizeof(thread));
+
+    // The AP keeps running on its boot stack as its idle thread
+    copy_name(idle->name, "idle");
+    idle->state = THREAD_RUNNING;
+    idle->priority = PRIORITY_LOW;
+    idle->cpu = c->index;
+    idle->on_cpu = 1;
+    idle->stack = boot_stack;
+    fpu_state_alloc(idle);
+    register_thread(idle);
+
+    c->idle = idle;
+    c->current = idle;
+    __sync_synchronize();
+    c->online = 1;
+
+    asm volatile ("sti");
+    idle_loop(0);
+}
+
+thread *thread_create(const char *name, void (*entry)(void *arg), void *arg,
+                      int priority) {
+    thread *t = kzalloc(sizeof(thread));
+    if (t == 0) {
+        return 0;
+    }
+    t->stack = kmalloc(THREAD_STACK_SIZE);
+    if (t->stack == 0 || fpu_state_alloc(t) != 0) {
+        kfree(t->stack);
+        kfree(t);
+        return 0;
+    }
+
+    copy_name(t->name, name);
+    t->entry = entry;
+    t->arg = arg;
+    t->priority = priority;
+
+    // One look at our CPU, so a move between reads can't mix two of them
+    unsigned int flags = irq_save();
+    cpu *c = this_cpu();
+    t->cpu = c->index;
+    t->console = c->current->console;  // Children inherit it
+    int is_idle = c->idle == 0;
+    irq_restore(flags);
+
+    // Initial frame popped by switch_context: EFLAGS (IF clear), edi, esi,
+    // ebx, ebp, then the return address.
+    unsigned int *sp = (unsigned int *)((unsigned int)t->stack + THREAD_STACK_SIZE);
+    *--sp = 0;                          // Fake return address for thread_start
+    *--sp = (unsigned int)thread_start;
+    *--sp = 0;                          // ebp
+    *--sp = 0;                          // ebx
+    *--sp = 0;                          // esi
+    *--sp = 0;                          // edi
+    *--sp = 0x002;                      // EFLAGS
+    t->esp = (unsigned int)sp;
+
+    register_thread(t);
+    if (is_idle) {
+        t->state = THREAD_READY;        // This is the idle thread; never queued
+    } else {
+        make_ready(t);
+    }
+    return t;
+}
+
+void thread_exit(void) {
+    fs_close_all(thread_current());
+    asm volatile ("cli");
+    this_cpu()->current->state = THREAD_DEAD;
+    schedule();
+    while (1); // Not reached
+}
+
+void thread_yield(void) {
+    unsigned int flags = irq_save();
+    schedule();
+    irq_restore(flags);
+}
+
+static void sleep_expired(void *arg) {
+    make_ready((thread *)arg);
+}
+
+void thread_sleep(unsigned int ms) {
+    unsigned int flags = irq_save();
+    thread *self = this_cpu()->current;
+    self->state = THREAD_BLOCKED;
+    timer_start(&self->sleep_timer, ms, 0, sleep_expired, self);
+    schedule();
+    irq_restore(flags);
+}
+
+thread *thread_current(void) {
+    // Read the CPU and its current thread without being moved in between
+    unsigned int flags = irq_save();
+    thread *self = this_cpu()->current;
+    irq_restore(flags);
+    return self;
+}
+
+thread *thread_list_lock(unsigned int *flags) {
+    *flags = spin_lock_irqsave(&threads_lock);
+    return all_threads;
+}
+
+void thread_list_unlock(unsigned int flags) {
+    spin_unlock_irqrestore(&threads_lock, flags);
+}
+
+void wait_queue_init(wait_queue *wq) {
+    wq->lock.locked = 0;
+    wq->threads.head = 0;
+    wq->threads.tail = 0;
+}
+
+void wait_queue_sleep(wait_queue *wq) {
+    thread *self = this_cpu()->current;
+    self->state = THREAD_BLOCKED;
+    queue_push(&wq->threads, self);
+    spin_unlock(&wq->lock);
+    schedule();
+    spin_lock(&wq->lock);
+}
+
+void wait_queue_wake_one(wait_queue *wq) {
+    unsigned int flags = spin_lock_irqsave(&wq->lock);
+    thread *t = queue_pop(&wq->threads);
+    spin_unlock_irqrestore(&wq->lock, flags);
+    if (t != 0) {
+        make_ready(t);
+    }
+}
+
+void wait_queue_wake_all(wait_queue *wq) {
+    unsigned int flags = spin_lock_irqsave(&wq->lock);
+    thread *t = wq->threads.head;
+    wq->threads.head = 0;
+    wq->threads.tail = 0;
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    while (t != 0) {
+        thread *next = t->next;
+        make_ready(t);
+        t = next;
+    }
+}
+
+void mutex_lock(mutex *m) {
+    unsigned int flags = spin_lock_irqsave(&m->waiters.lock);
+    while (m->locked) {
+        wait_queue_sleep(&m->waiters);
+    }
+    m->locked = 1;
+    spin_unlock_irqrestore(&m->waiters.lock, flags);
+}
+
+void mutex_unlock(mutex *m) {
+    unsigned int flags = spin_lock_irqsave(&m->waiters.lock);
+    m->locked = 0;
+    spin_unlock_irqrestore(&m->waiters.lock, flags);
+    wait_queue_wake_one(&m->waiters);
+}
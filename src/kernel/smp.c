@@ -0,0 +1,293 @@
+// smp.c
+#include "smp.h"
+#include "sched.h"
+#include "gdt.h"
+#include "idt.h"
+#include "fpu.h"
+#include "paging.h"
+#include "heap.h"
+#include "timer.h"
+#include "pmm.h"
+#include "klib.h"
+
+// Local APIC registers (byte offsets)
+#define LAPIC_ID 0x020
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define ICR_INIT 0x00004500      // INIT, level assert
+#define ICR_STARTUP 0x00004600   // Start-up IPI
+#define ICR_PENDING 0x00001000
+
+typedef struct {
+    char signature[8];
+    unsigned char checksum;
+    char oem_id[6];
+    unsigned char revision;
+    unsigned int rsdt_address;
+} __attribute__((packed)) acpi_rsdp;
+
+typedef struct {
+    char signature[4];
+    unsigned int length;
+    unsigned char revision;
+    unsigned char checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    unsigned int oem_revision;
+    unsigned int creator_id;
+    unsigned int creator_revision;
+} __attribute__((packed)) acpi_header;
+
+typedef struct {
+    acpi_header header;
+    unsigned int lapic_address;
+    unsigned int flags;
+    // Variable-length interrupt controller entries follow
+} __attribute__((packed)) acpi_madt;
+
+// Parameters appended to the blob in trampoline.asm
+typedef struct {
+    unsigned int cr3;
+    unsigned int stack;
+    unsigned int entry;
+} trampoline_params_t;
+
+extern char trampoline_start[];
+extern char trampoline_params[];
+extern char trampoline_end[];
+
+static volatile unsigned int *lapic = 0;
+static unsigned int lapic_ticks_per_ms = 0;
+static volatile int ap_boot_index;
+static void *ap_boot_stack;
+
+static unsigned int lapic_read(unsigned int reg) {
+    return lapic[reg / 4];
+}
+
+static void lapic_write(unsigned int reg, unsigned int value) {
+    lapic[reg / 4] = value;
+    (void)lapic[LAPIC_ID / 4]; // Read back to post the write
+}
+
+int lapic_present(void) {
+    return lapic != 0;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static int acpi_checksum_ok(const void *table, unsigned int length) {
+    const unsigned char *p = table;
+    unsigned char sum = 0;
+    for (unsigned int i = 0; i < length; i++) {
+        sum += p[i];
+    }
+    return sum == 0;
+}
+
+static acpi_rsdp *rsdp_scan(unsigned int start, unsigned int length) {
+    for (unsigned int addr = start; addr < start + length; addr += 16) {
+        acpi_rsdp *rsdp = (acpi_rsdp *)addr;
+        const char *sig = "RSD PTR ";
+        int match = 1;
+        for (int i = 0; i < 8; i++) {
+            if (rsdp->signature[i] != sig[i]) {
+                match = 0;
+                break;
+            }
+        }
+        if (match && acpi_checksum_ok(rsdp, 20)) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+// Locate the MADT via the RSDP. The BDA pointer to the EBDA lives in page
+// 0, which stays unmapped, so scan the conventional EBDA spot instead.
+static acpi_madt *find_madt(void) {
+    acpi_rsdp *rsdp = rsdp_scan(0x9FC00, 1024);
+    if (rsdp == 0) {
+        rsdp = rsdp_scan(0xE0000, 0x20000);
+    }
+    if (rsdp == 0) {
+        return 0;
+    }
+
+    // ACPI tables usually sit in reserved RAM above the identity map
+    acpi_header *rsdt = (acpi_header *)rsdp->rsdt_address;
+    if (paging_map_mmio((unsigned int)rsdt, sizeof(acpi_header)) != 0 ||
+        paging_map_mmio((unsigned int)rsdt, rsdt->length) != 0 ||
+        !acpi_checksum_ok(rsdt, rsdt->length)) {
+        return 0;
+    }
+
+    unsigned int entries = (rsdt->length - sizeof(acpi_header)) / 4;
+    unsigned int *tables = (unsigned int *)(rsdt + 1);
+    for (unsigned int i = 0; i < entries; i++) {
+        acpi_header *h = (acpi_header *)tables[i];
+        if (paging_map_mmio((unsigned int)h, sizeof(acpi_header)) != 0) {
+            continue;
+        }
+        if (h->signature[0] == 'A' && h->signature[1] == 'P' &&
+            h->signature[2] == 'I' && h->signature[3] == 'C' &&
+            paging_map_mmio((unsigned int)h, h->length) == 0 &&
+            acpi_checksum_ok(h, h->length)) {
+            return (acpi_madt *)h;
+        }
+    }
+    return 0;
+}
+
+// Fill cpus[] with one entry per enabled processor; BSP stays index 0
+static void parse_madt(acpi_madt *madt, unsigned int bsp_apic_id) {
+    unsigned char *p = (unsigned char *)(madt + 1);
+    unsigned char *end = (unsigned char *)madt + madt->header.length;
+
+    cpus[0].apic_id = bsp_apic_id;
+    cpu_count = 1;
+    while (p + 2 <= end && p[1] >= 2) {
+        // Type 0: processor local APIC; flags bit 0 = enabled
+        if (p[0] == 0 && (p[4] & 1) && p[3] != bsp_apic_id &&
+            cpu_count < MAX_CPUS) {
+            cpus[cpu_count++].apic_id = p[3];
+        }
+        p += p[1];
+    }
+}
+
+static void lapic_timer_irq(interrupt_frame *frame) {
+    (void)frame;
+    sched_tick();
+}
+
+static void lapic_spurious_irq(interrupt_frame *frame) {
+    (void)frame; // No EOI for spurious interrupts
+}
+
+static void lapic_enable(void) {
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+static void lapic_timer_start(void) {
+    lapic_write(LAPIC_TIMER_DIVIDE, 0x3);  // Divide by 16
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, lapic_ticks_per_ms);
+}
+
+// Count LAPIC timer ticks across a PIT-measured interval
+static void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIVIDE, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, 0x10000);  // Masked, one-shot
+
+    unsigned long long start = ktime_ms();
+    while (ktime_ms() == start) {
+        asm volatile ("pause");             // Align to a tick edge
+    }
+    start = ktime_ms();
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    while (ktime_ms() < start + 20) {
+        asm volatile ("pause");
+    }
+    unsigned int elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    lapic_ticks_per_ms = elapsed / 20;
+}
+
+static void ap_main(void) {
+    int index = ap_boot_index;
+    void *stack = ap_boot_stack;
+
+    gdt_load(index);
+    idt_load();
+    fpu_init_cpu();
+    lapic_enable();
+    lapic_timer_start();
+
+    sched_init_ap(stack); // Marks the CPU online; never returns
+}
+
+static void ipi_send(unsigned int apic_id, unsigned int command) {
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        asm volatile ("pause");
+    }
+}
+
+static int start_ap(int index) {
+    trampoline_params_t *params = (trampoline_params_t *)
+        (AP_TRAMPOLINE_ADDR + (trampoline_params - trampoline_start));
+
+    ap_boot_stack = kmalloc(THREAD_STACK_SIZE);
+    if (ap_boot_stack == 0) {
+        return -1;
+    }
+    ap_boot_index = index;
+    params->cr3 = paging_directory_phys();
+    params->stack = (unsigned int)ap_boot_stack + THREAD_STACK_SIZE;
+    params->entry = (unsigned int)ap_main;
+
+    // INIT, then the start-up IPI twice as the MP spec recommends
+    unsigned int apic_id = cpus[index].apic_id;
+    ipi_send(apic_id, ICR_INIT);
+    ksleep(10);
+    for (int i = 0; i < 2; i++) {
+        ipi_send(apic_id, ICR_STARTUP | (AP_TRAMPOLINE_ADDR >> 12));
+        ksleep(1);
+    }
+
+    unsigned long long deadline = ktime_ms() + 100;
+    while (!cpus[index].online && ktime_ms() < deadline) {
+        thread_yield();
+    }
+    if (!cpus[index].online) {
+        kfree(ap_boot_stack);
+        return -1;
+    }
+    return 0;
+}
+
+void smp_init(void) {
+    acpi_madt *madt = find_madt();
+    if (madt == 0 || paging_map_mmio(madt->lapic_address, PAGE_SIZE) != 0) {
+        return; // Uniprocessor: keep the PIT-driven scheduler tick
+    }
+    lapic = (volatile unsigned int *)madt->lapic_address;
+
+    isr_register(LAPIC_TIMER_VECTOR, lapic_timer_irq);
+    isr_register(LAPIC_SPURIOUS_VECTOR, lapic_spurious_irq);
+
+    lapic_enable();
+    parse_madt(madt, lapic_read(LAPIC_ID) >> 24);
+    lapic_timer_calibrate();
+
+    // Every CPU, BSP included, now schedules from its own LAPIC timer
+    sched_use_local_timers();
+    lapic_timer_start();
+
+    // Real-mode entry code must live below 1 MB; the PMM never hands out
+    // low memory, so the page at AP_TRAMPOLINE_ADDR is ours.
+    unsigned int size = trampoline_end - trampoline_start;
+    kmemcpy((void *)AP_TRAMPOLINE_ADDR, trampoline_start, size);
+
+    int requested = cpu_count;
+    for (int i = 1; i < requested; i++) {
+        if (start_ap(i) != 0) {
+            cpu_count = i; // Keep indices dense; give up on the rest
+            break;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+// strbuf.c
+#include "strbuf.h"
+#include "kmem.h"
+#include "kprintf.h"
+
+void sb_init(strbuf *sb, char *buf, unsigned int size) {
+    sb->buf = buf;
+    sb->size = size;
+    sb->len = 0;
+    sb->truncated = 0;
+    if (size > 0) {
+        buf[0] = '\0';
+    }
+}
+
+void sb_append_n(strbuf *sb, const char *s, unsigned int n) {
+    unsigned int room = sb->size > sb->len ? sb->size - sb->len - 1 : 0;
+    if (n > room) {
+        n = room;
+        sb->truncated = 1;
+    }
+    kmemcpy(sb->buf + sb->len, s, n);
+    sb->len += n;
+    if (sb->size > 0) {
+        sb->buf[sb->len] = '\0';
+    }
+}
+
+void sb_append(strbuf *sb, const char *s) {
+    unsigned int n = 0;
+    while (s[n]) n++;
+    sb_append_n(sb, s, n);
+}
+
+void sb_append_char(strbuf *sb, char c) {
+    sb_append_n(sb, &c, 1);
+}
+
+void sb_append_int(strbuf *sb, int value) {
+    char digits[12];
+    unsigned int n = ksnprintf(digits, sizeof(digits), "%d", value);
+    sb_append_n(sb, digits, n);
+}
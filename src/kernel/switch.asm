@@ -0,0 +1,28 @@
+; switch.asm
+bits 32
+
+section .text
+global switch_context
+
+; void switch_context(unsigned int *old_esp, unsigned int new_esp)
+; Saves the callee-saved registers and EFLAGS on the current stack, stores
+; the stack pointer in *old_esp and resumes the thread whose stack was saved
+; as new_esp. A new thread's stack is pre-built in the same layout.
+switch_context:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    pushf
+    mov [eax], esp
+    mov esp, edx
+    popf
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+
+section .note.GNU-stack
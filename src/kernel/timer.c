@@ -0,0 +1,125 @@
+// timer.c
+#include "timer.h"
+#include "idt.h"
+#include "klib.h"
+#include "sched.h"
+
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND 0x43
+#define PIT_BASE_FREQUENCY 1193182
+
+static volatile unsigned long long ticks = 0;
+static spinlock wheel_lock = SPINLOCK_INIT;
+
+// Hashed timer wheel: a timer lives in slot (expires % SLOTS) and is only
+// examined when the wheel passes that slot, so each tick costs O(timers in
+// one slot) no matter how many timers are pending in total.
+static ktimer *wheel[TIMER_WHEEL_SLOTS];
+
+static void wheel_insert(ktimer *timer) {
+    ktimer **slot = &wheel[timer->expires & (TIMER_WHEEL_SLOTS - 1)];
+    timer->next = *slot;
+    if (*slot != 0) {
+        (*slot)->pprev = &timer->next;
+    }
+    *slot = timer;
+    timer->pprev = slot;
+}
+
+static void wheel_remove(ktimer *timer) {
+    if (timer->pprev == 0) {
+        return;
+    }
+    *timer->pprev = timer->next;
+    if (timer->next != 0) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+static void timer_irq(interrupt_frame *frame) {
+    (void)frame;
+    ktimer *expired = 0;
+
+    spin_lock(&wheel_lock);
+    unsigned long long now = ++ticks;
+    ktimer *timer = wheel[now & (TIMER_WHEEL_SLOTS - 1)];
+    while (timer != 0) {
+        ktimer *next = timer->next;
+        // Timers further than one revolution away stay for a later pass
+        if (timer->expires <= now) {
+            wheel_remove(timer);
+            if (timer->period != 0) {
+                timer->expires = now + timer->period;
+                wheel_insert(timer);
+            }
+            timer->fire_next = expired;
+            expired = timer;
+        }
+        timer = next;
+    }
+    spin_unlock(&wheel_lock);
+
+    // Callbacks may start or cancel timers, so run them unlocked
+    while (expired != 0) {
+        ktimer *next = expired->fire_next;
+        expired->callback(expired->arg);
+        expired = next;
+    }
+}
+
+void timer_init(void) {
+    unsigned int divisor = PIT_BASE_FREQUENCY / TIMER_HZ;
+
+    outb(PIT_COMMAND, 0x34);  // Channel 0, lobyte/hibyte, rate generator
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+
+    irq_register(IRQ_TIMER, timer_irq);
+}
+
+unsigned long long ktime_ms(void) {
+    // A 64-bit load is two instructions on i386; retry if IRQ0 lands
+    // between them.
+    unsigned long long a, b;
+    do {
+        a = ticks;
+        b = ticks;
+    } while (a != b);
+    return a;
+}
+
+void ksleep(unsigned int ms) {
+    if (thread_current() != 0) {
+        thread_sleep(ms);
+        return;
+    }
+
+    // Before the scheduler is up every tick wakes us, so halt until the
+    // deadline has passed
+    unsigned long long deadline = ktime_ms() + ms;
+    while (ktime_ms() < deadline) {
+        asm volatile ("hlt");
+    }
+}
+
+void timer_start(ktimer *timer, unsigned int delay_ms, unsigned int period_ms,
+                 timer_callback callback, void *arg) {
+    unsigned int flags = spin_lock_irqsave(&wheel_lock);
+
+    wheel_remove(timer);
+    timer->expires = ticks + (delay_ms ? delay_ms : 1);
+    timer->period = period_ms;
+    timer->callback = callback;
+    timer->arg = arg;
+    wheel_insert(timer);
+
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+void timer_cancel(ktimer *timer) {
+    unsigned int flags = spin_lock_irqsave(&wheel_lock);
+    wheel_remove(timer);
+    spin_unlock_irqrestore(&wheel_lock, flags);
+}
@@ -0,0 +1,66 @@
+; trampoline.asm
+; Application processors start in real mode at AP_TRAMPOLINE_ADDR. smp.c
+; copies this blob there and fills in trampoline_params; the code switches
+; to protected mode, enables paging with the kernel page directory and
+; calls the C entry point on its own stack.
+
+TRAMPOLINE_ADDR equ 0x8000
+%define TADDR(label) (label - trampoline_start + TRAMPOLINE_ADDR)
+
+section .text
+global trampoline_start
+global trampoline_params
+global trampoline_end
+
+bits 16
+trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [TADDR(tramp_gdtr)]
+    mov eax, cr0
+    or eax, 1              ; CR0.PE
+    mov cr0, eax
+    jmp dword 0x08:TADDR(tramp_protected)
+
+bits 32
+tramp_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov eax, cr4
+    or eax, 0x10           ; CR4.PSE
+    mov cr4, eax
+    mov eax, [TADDR(tramp_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80000000     ; CR0.PG
+    mov cr0, eax
+    mov esp, [TADDR(tramp_stack)]
+    mov eax, [TADDR(tramp_entry)]
+    call eax               ; Never returns
+.halt:
+    hlt
+    jmp .halt
+
+align 8
+tramp_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF  ; Flat code
+    dq 0x00CF92000000FFFF  ; Flat data
+tramp_gdtr:
+    dw 3 * 8 - 1
+    dd TADDR(tramp_gdt)
+
+align 4
+trampoline_params:
+tramp_cr3:   dd 0
+tramp_stack: dd 0
+tramp_entry: dd 0
+trampoline_end:
+
+section .note.GNU-stack
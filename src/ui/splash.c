@@ -1,6 +1,7 @@
 // splash.c
 #include "vga.h"
 #include "klib.h"
+#include "timer.h"
 
 void show_splash_screen(void) {
     vga_clear();
@@ -95,7 +96,7 @@ void show_splash_screen(void) {
     for (int i = 0; loading[i]; i++) {
         vga_putc_at(loading_x + i, 15, loading[i]);
         // Delay for text animation (about 0.5 seconds total)
-        for (volatile int j = 0; j < 800000; j++);
+        ksleep(20);
     }
     
     // Draw progress bar
@@ -115,7 +116,7 @@ void show_splash_screen(void) {
             vga_putc_at(bar_start + progress, 17, '>');
         }
         // Delay for progress bar animation
-        for (volatile int j = 0; j < 1500000; j++);
+        ksleep(50);
     }
     
     // Final message
@@ -126,7 +127,7 @@ void show_splash_screen(void) {
     }
     
     // Wait for exactly 5 seconds total (2.5 seconds after animations)
-    for (volatile int i = 0; i < 12500000; i++);
+    ksleep(2500);
     
     // Clear screen for the actual OS
     vga_clear();